@@ -9,18 +9,11 @@ typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
 
-#define TIMER_INIT \
-    LARGE_INTEGER frequency; \
-    LARGE_INTEGER t1,t2; \
-    double elapsedTime; \
-    QueryPerformanceFrequency(&frequency);
-#define TIMER_START QueryPerformanceCounter(&t1);
-#define TIMER_STOP \
-    QueryPerformanceCounter(&t2); \
-    elapsedTime=(float)(t2.QuadPart-t1.QuadPart)/frequency.QuadPart; \
-    printf("Elapsed Time: %fms\n", elapsedTime * 1000.0f);
-
 #define ARRAY_LENGTH(array) (sizeof(array) / sizeof(array[0]))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
+#define VK_CHECK(x) if((x) != VK_SUCCESS) { 			\
+	assert(false); 										\
+	printf("Vulkan error: %s:%i", __FILE__, __LINE__); 	\
+}
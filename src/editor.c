@@ -14,11 +14,13 @@ static Editor editor_initialize() {
 			.view = {
 				.start_line = 0
 			}
-		}
+		},
+		.next_line_version = 0
 	};
 }
 
 static void editor_open_file(Editor *editor, const char *path) {
+	TRACE_ZONE_BEGIN(zone, "editor_open_file");
 	FILE *file = fopen(path, "r");
 
 	editor->active_document.lines = malloc(sizeof(TextLine) * 1024);
@@ -32,6 +34,7 @@ static void editor_open_file(Editor *editor, const char *path) {
 
 		u32 new_offset = ftell(file);
 		editor->active_document.lines[line].length = new_offset - offset;
+		editor->active_document.lines[line].version = editor->next_line_version++;
 		offset = new_offset;
 
 		if(!result) {
@@ -43,6 +46,7 @@ static void editor_open_file(Editor *editor, const char *path) {
 
 	editor->active_document.num_lines = line;
 	fclose(file);
+	TRACE_ZONE_END(zone);
 }
 
 static void editor_destroy(Editor *editor) {
@@ -75,6 +79,8 @@ static DrawList text_document_get_text_draw_list(TextDocument *document, u32 num
 			.text = {
 				.content = document->lines[line].content,
 				.length = document->lines[line].length,
+				.line = line,
+				.version = document->lines[line].version,
 				.column = line_number_digit_count + 1,
 				.row = i
 			}
@@ -98,6 +104,7 @@ static DrawList text_document_get_line_number_draw_list(TextDocument *document,
 			.type = DRAW_COMMAND_NUMBER,
 			.number = {
 				.num = line,
+				.line = line,
 				.column = line_number_digit_count - digits_in_number,
 				.row = i
 			}
@@ -5,6 +5,7 @@
 typedef struct TextLine {
 	char *content;
 	u32 length;
+	u32 version;
 } TextLine;
 
 typedef struct TextView {
@@ -20,6 +21,9 @@ typedef struct TextDocument {
 
 typedef struct Editor {
 	TextDocument active_document;
+
+	// Every change to the content of a line assigns it a new version
+	u32 next_line_version;
 } Editor;
 
 static Editor editor_initialize();
@@ -0,0 +1,99 @@
+#include "frame_queue.h"
+
+// Takes ownership of the draw commands
+static FrameSnapshot *frame_snapshot_create(DrawList *draw_lists, u32 num_draw_lists) {
+	assert(num_draw_lists <= MAX_SNAPSHOT_DRAW_LISTS);
+
+	FrameSnapshot *snapshot = (FrameSnapshot *)malloc(sizeof(FrameSnapshot));
+	assert(snapshot);
+	snapshot->num_draw_lists = num_draw_lists;
+
+	u64 text_size = 0;
+	for(u32 i = 0; i < num_draw_lists; ++i) {
+		snapshot->draw_lists[i] = draw_lists[i];
+		for(u32 j = 0; j < draw_lists[i].num_commands; ++j) {
+			if(draw_lists[i].commands[j].type == DRAW_COMMAND_TEXT) {
+				text_size += draw_lists[i].commands[j].text.length;
+			}
+		}
+	}
+
+	// All text is copied into a single block, the commands are pointed at the copy
+	snapshot->text = (char *)malloc(MAX(text_size, 1));
+	assert(snapshot->text);
+	u64 text_offset = 0;
+	for(u32 i = 0; i < num_draw_lists; ++i) {
+		for(u32 j = 0; j < draw_lists[i].num_commands; ++j) {
+			DrawCommand *command = &snapshot->draw_lists[i].commands[j];
+			if(command->type == DRAW_COMMAND_TEXT) {
+				memcpy(&snapshot->text[text_offset], command->text.content, command->text.length);
+				command->text.content = &snapshot->text[text_offset];
+				text_offset += command->text.length;
+			}
+		}
+	}
+
+	return snapshot;
+}
+
+static void frame_snapshot_destroy(FrameSnapshot *snapshot) {
+	for(u32 i = 0; i < snapshot->num_draw_lists; ++i) {
+		free(snapshot->draw_lists[i].commands);
+	}
+	free(snapshot->text);
+	free(snapshot);
+}
+
+// Producer side, always publishes. A snapshot that does not fit goes to the overflow slot and
+// replaces the one there, which is stale by then anyway.
+static void frame_queue_push(FrameQueue *queue, FrameSnapshot *snapshot) {
+	u32 tail = queue->tail;
+	u32 head = platform_atomic_load_u32(&queue->head);
+	// The consumer prefers the overflow snapshot over everything in the queue, so once it is
+	// taken newer snapshots must not be queued behind it until the consumer took it
+	if(tail - head < FRAME_QUEUE_CAPACITY && !platform_atomic_load_pointer(&queue->overflow)) {
+		queue->slots[tail % FRAME_QUEUE_CAPACITY] = snapshot;
+		platform_atomic_store_u32(&queue->tail, tail + 1);
+		return;
+	}
+
+	FrameSnapshot *replaced = (FrameSnapshot *)platform_atomic_exchange_pointer(&queue->overflow, snapshot);
+	if(replaced) {
+		frame_snapshot_destroy(replaced);
+	}
+}
+
+// Consumer side. Only the newest snapshot is returned, older ones
+// are stale and dropped without being rendered.
+static FrameSnapshot *frame_queue_pop_latest(FrameQueue *queue) {
+	FrameSnapshot *snapshot = NULL;
+	u32 head = queue->head;
+	u32 tail = platform_atomic_load_u32(&queue->tail);
+	if(head != tail) {
+		for(; head != tail - 1; ++head) {
+			frame_snapshot_destroy(queue->slots[head % FRAME_QUEUE_CAPACITY]);
+		}
+		snapshot = queue->slots[head % FRAME_QUEUE_CAPACITY];
+		platform_atomic_store_u32(&queue->head, tail);
+	}
+
+	// Only taken after the queue was read, a snapshot in the overflow slot is newer than
+	// every snapshot that was queued before it
+	FrameSnapshot *overflow = (FrameSnapshot *)platform_atomic_exchange_pointer(&queue->overflow, NULL);
+	if(overflow) {
+		if(snapshot) {
+			frame_snapshot_destroy(snapshot);
+		}
+		snapshot = overflow;
+	}
+	return snapshot;
+}
+
+// Only valid once both threads are done with the queue
+static void frame_queue_destroy(FrameQueue *queue) {
+	FrameSnapshot *snapshot = frame_queue_pop_latest(queue);
+	if(snapshot) {
+		frame_snapshot_destroy(snapshot);
+	}
+	*queue = (FrameQueue) { 0 };
+}
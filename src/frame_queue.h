@@ -0,0 +1,37 @@
+#pragma once
+
+#define FRAME_QUEUE_CAPACITY 4
+#define MAX_SNAPSHOT_DRAW_LISTS 4
+
+// Everything the render thread needs to draw one frame. The snapshot owns its
+// draw commands and a copy of all text, so the editor may change the document
+// while the frame is being rendered.
+typedef struct FrameSnapshot {
+	DrawList draw_lists[MAX_SNAPSHOT_DRAW_LISTS];
+	u32 num_draw_lists;
+	char *text;
+} FrameSnapshot;
+
+// Lock-free single-producer/single-consumer queue of snapshots, the editor
+// thread pushes and the render thread pops. head and tail only ever increase
+// and are kept on separate cache lines.
+typedef struct FrameQueue {
+	FrameSnapshot *slots[FRAME_QUEUE_CAPACITY];
+	u8 padding0[64];
+	volatile u32 head; // Written by the consumer only
+	u8 padding1[64];
+	volatile u32 tail; // Written by the producer only
+	u8 padding2[64];
+
+	// The newest snapshot if it did not fit into the queue. Both threads swap it atomically, so
+	// the consumer picks it up as soon as it looks for a frame and the producer never has to
+	// come back to publish it.
+	void *volatile overflow;
+} FrameQueue;
+
+static FrameSnapshot *frame_snapshot_create(DrawList *draw_lists, u32 num_draw_lists);
+static void frame_snapshot_destroy(FrameSnapshot *snapshot);
+
+static void frame_queue_push(FrameQueue *queue, FrameSnapshot *snapshot);
+static FrameSnapshot *frame_queue_pop_latest(FrameQueue *queue);
+static void frame_queue_destroy(FrameQueue *queue);
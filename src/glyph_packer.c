@@ -0,0 +1,108 @@
+#include "glyph_packer.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define GLYPH_PACKER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GLYPH_PACKER_SSE2
+#endif
+
+static GlyphCellTable glyph_cell_table_create(u32 glyphs_per_row) {
+	GlyphCellTable table;
+	for(u32 c = 0; c < ARRAY_LENGTH(table.cells); ++c) {
+		// Characters without a glyph (control characters, newlines, non-ASCII bytes)
+		// use the empty cell of the space character
+		u32 glyph_index = (c > 0x20 && c <= 0x7E) ? c - 0x20 : 0;
+		table.cells[c] = (glyph_index % glyphs_per_row) | ((glyph_index / glyphs_per_row) << 16);
+	}
+	return table;
+}
+
+static void pack_glyph_instances_scalar(const GlyphCellTable *table, const char *content, u32 length,
+	u32 column, u32 row, GlyphInstance *instances) {
+	u64 screen_cell = column | (row << 16);
+	for(u32 i = 0; i < length; ++i) {
+		instances[i] = (u64)table->cells[(u8)content[i]] | ((screen_cell + i) << 32);
+	}
+}
+
+#ifdef GLYPH_PACKER_AVX2
+// Interleaves 8 atlas cells with 8 screen cells into 8 glyph instances
+static void store_glyph_instances_avx2(GlyphInstance *instances, __m256i cells, __m256i screen_cells) {
+	__m256i lo = _mm256_unpacklo_epi32(cells, screen_cells);
+	__m256i hi = _mm256_unpackhi_epi32(cells, screen_cells);
+	_mm256_storeu_si256((__m256i *)instances, _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i *)(instances + 4), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+#endif
+
+static void pack_glyph_instances(const GlyphCellTable *table, const char *content, u32 length,
+	u32 column, u32 row, GlyphInstance *instances) {
+	assert(column + length <= 0xFFFF && row <= 0xFFFF);
+	u32 i = 0;
+
+#if defined(GLYPH_PACKER_AVX2)
+	// 16 characters per iteration, the atlas cells are gathered straight from the table
+	__m256i screen_cells = _mm256_add_epi32(_mm256_set1_epi32(column | (row << 16)),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	const __m256i step = _mm256_set1_epi32(8);
+	for(; i + 16 <= length; i += 16) {
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(content + i));
+		__m256i cells_lo = _mm256_i32gather_epi32((const int *)table->cells, _mm256_cvtepu8_epi32(bytes), 4);
+		__m256i cells_hi = _mm256_i32gather_epi32((const int *)table->cells,
+			_mm256_cvtepu8_epi32(_mm_srli_si128(bytes, 8)), 4);
+
+		store_glyph_instances_avx2(instances + i, cells_lo, screen_cells);
+		screen_cells = _mm256_add_epi32(screen_cells, step);
+		store_glyph_instances_avx2(instances + i + 8, cells_hi, screen_cells);
+		screen_cells = _mm256_add_epi32(screen_cells, step);
+	}
+#elif defined(GLYPH_PACKER_SSE2)
+	// 16 characters per iteration as two interleaved packs of 8, without a gather instruction
+	// the table lookups stay scalar
+	__m128i screen_cells = _mm_add_epi32(_mm_set1_epi32(column | (row << 16)), _mm_setr_epi32(0, 1, 2, 3));
+	const __m128i step = _mm_set1_epi32(4);
+	for(; i + 16 <= length; i += 16) {
+		const u8 *bytes = (const u8 *)content + i;
+		__m128i cells_0 = _mm_setr_epi32(table->cells[bytes[0]], table->cells[bytes[1]],
+			table->cells[bytes[2]], table->cells[bytes[3]]);
+		__m128i cells_8 = _mm_setr_epi32(table->cells[bytes[8]], table->cells[bytes[9]],
+			table->cells[bytes[10]], table->cells[bytes[11]]);
+		__m128i cells_4 = _mm_setr_epi32(table->cells[bytes[4]], table->cells[bytes[5]],
+			table->cells[bytes[6]], table->cells[bytes[7]]);
+		__m128i cells_12 = _mm_setr_epi32(table->cells[bytes[12]], table->cells[bytes[13]],
+			table->cells[bytes[14]], table->cells[bytes[15]]);
+
+		__m128i screen_cells_4 = _mm_add_epi32(screen_cells, step);
+		__m128i screen_cells_8 = _mm_add_epi32(screen_cells_4, step);
+		__m128i screen_cells_12 = _mm_add_epi32(screen_cells_8, step);
+		_mm_storeu_si128((__m128i *)(instances + i), _mm_unpacklo_epi32(cells_0, screen_cells));
+		_mm_storeu_si128((__m128i *)(instances + i + 2), _mm_unpackhi_epi32(cells_0, screen_cells));
+		_mm_storeu_si128((__m128i *)(instances + i + 8), _mm_unpacklo_epi32(cells_8, screen_cells_8));
+		_mm_storeu_si128((__m128i *)(instances + i + 10), _mm_unpackhi_epi32(cells_8, screen_cells_8));
+		_mm_storeu_si128((__m128i *)(instances + i + 4), _mm_unpacklo_epi32(cells_4, screen_cells_4));
+		_mm_storeu_si128((__m128i *)(instances + i + 6), _mm_unpackhi_epi32(cells_4, screen_cells_4));
+		_mm_storeu_si128((__m128i *)(instances + i + 12), _mm_unpacklo_epi32(cells_12, screen_cells_12));
+		_mm_storeu_si128((__m128i *)(instances + i + 14), _mm_unpackhi_epi32(cells_12, screen_cells_12));
+		screen_cells = _mm_add_epi32(screen_cells_12, step);
+	}
+	// One pack of 8 shortens the scalar tail
+	if(i + 8 <= length) {
+		const u8 *bytes = (const u8 *)content + i;
+		__m128i cells_0 = _mm_setr_epi32(table->cells[bytes[0]], table->cells[bytes[1]],
+			table->cells[bytes[2]], table->cells[bytes[3]]);
+		__m128i cells_4 = _mm_setr_epi32(table->cells[bytes[4]], table->cells[bytes[5]],
+			table->cells[bytes[6]], table->cells[bytes[7]]);
+
+		__m128i screen_cells_4 = _mm_add_epi32(screen_cells, step);
+		_mm_storeu_si128((__m128i *)(instances + i), _mm_unpacklo_epi32(cells_0, screen_cells));
+		_mm_storeu_si128((__m128i *)(instances + i + 2), _mm_unpackhi_epi32(cells_0, screen_cells));
+		_mm_storeu_si128((__m128i *)(instances + i + 4), _mm_unpacklo_epi32(cells_4, screen_cells_4));
+		_mm_storeu_si128((__m128i *)(instances + i + 6), _mm_unpackhi_epi32(cells_4, screen_cells_4));
+		i += 8;
+	}
+#endif
+
+	pack_glyph_instances_scalar(table, content + i, length - i, column + i, row, instances + i);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// A glyph instance packs the atlas cell and the screen cell of one character into 64 bits,
+// the vertex shader expands every instance into the quad of the character.
+//  bits  0-15: atlas cell x
+//  bits 16-31: atlas cell y
+//  bits 32-47: screen column
+//  bits 48-63: row, the renderer stores the document line (modulo 2^16) so that
+//              blocks of instances stay valid while scrolling
+typedef u64 GlyphInstance;
+
+// Low 32 bits of the glyph instance for every byte value, so packing
+// a character is a single lookup instead of a division by the atlas width.
+typedef struct GlyphCellTable {
+	u32 cells[256];
+} GlyphCellTable;
+
+static GlyphCellTable glyph_cell_table_create(u32 glyphs_per_row);
+
+static void pack_glyph_instances(const GlyphCellTable *table, const char *content, u32 length,
+	u32 column, u32 row, GlyphInstance *instances);
+static void pack_glyph_instances_scalar(const GlyphCellTable *table, const char *content, u32 length,
+	u32 column, u32 row, GlyphInstance *instances);
@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common_types.h"
+#include "glyph_packer.c"
+
+// Compares pack_glyph_instances against pack_glyph_instances_scalar on lines of source code
+// lengths and checks that both produce the same instances. Build with ATLAS_ENABLE_AVX2 to
+// measure the AVX2 path instead of the SSE2 one.
+#define BENCH_NUM_LINES 4096
+#define BENCH_MAX_LINE_LENGTH 160
+#define BENCH_ITERATIONS 50
+#define BENCH_ROUNDS 10 // The fastest round of each path counts, which filters out preemption
+#define BENCH_GLYPHS_PER_ROW 37
+
+typedef void (*PackFunction)(const GlyphCellTable *table, const char *content, u32 length,
+	u32 column, u32 row, GlyphInstance *instances);
+
+typedef struct BenchLines {
+	char *content;
+	u32 *offsets;
+	u32 *lengths;
+	u32 num_characters;
+} BenchLines;
+
+static u64 get_time_ns(void) {
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (u64)time.tv_sec * 1000000000ull + (u64)time.tv_nsec;
+}
+
+// Printable ASCII with some tabs and non-ASCII bytes, which map to the empty cell
+static BenchLines create_bench_lines(void) {
+	BenchLines lines = {
+		.content = (char *)malloc(BENCH_NUM_LINES * BENCH_MAX_LINE_LENGTH),
+		.offsets = (u32 *)malloc(BENCH_NUM_LINES * sizeof(u32)),
+		.lengths = (u32 *)malloc(BENCH_NUM_LINES * sizeof(u32))
+	};
+	assert(lines.content && lines.offsets && lines.lengths);
+
+	srand(1);
+	for(u32 i = 0; i < BENCH_NUM_LINES; ++i) {
+		lines.offsets[i] = lines.num_characters;
+		lines.lengths[i] = (u32)(rand() % BENCH_MAX_LINE_LENGTH);
+		for(u32 j = 0; j < lines.lengths[i]; ++j) {
+			int r = rand() % 100;
+			lines.content[lines.num_characters++] = r == 0 ? '\t' : r == 1 ? (char)0xC3 : (char)(0x20 + rand() % 95);
+		}
+	}
+	return lines;
+}
+
+static u64 run_pack_function(PackFunction pack, const GlyphCellTable *table, const BenchLines *lines,
+	GlyphInstance *instances) {
+	u64 start = get_time_ns();
+	for(u32 iteration = 0; iteration < BENCH_ITERATIONS; ++iteration) {
+		for(u32 i = 0; i < BENCH_NUM_LINES; ++i) {
+			u32 offset = lines->offsets[i];
+			pack(table, lines->content + offset, lines->lengths[i], 0, i, instances + offset);
+		}
+	}
+	return get_time_ns() - start;
+}
+
+int main(void) {
+	GlyphCellTable table = glyph_cell_table_create(BENCH_GLYPHS_PER_ROW);
+	BenchLines lines = create_bench_lines();
+	GlyphInstance *scalar_instances = (GlyphInstance *)malloc(lines.num_characters * sizeof(GlyphInstance));
+	GlyphInstance *instances = (GlyphInstance *)malloc(lines.num_characters * sizeof(GlyphInstance));
+	assert(scalar_instances && instances);
+
+	u64 scalar_ns = UINT64_MAX;
+	u64 simd_ns = UINT64_MAX;
+	for(u32 round = 0; round < BENCH_ROUNDS; ++round) {
+		scalar_ns = MIN(scalar_ns, run_pack_function(pack_glyph_instances_scalar, &table, &lines, scalar_instances));
+		simd_ns = MIN(simd_ns, run_pack_function(pack_glyph_instances, &table, &lines, instances));
+	}
+
+#if defined(GLYPH_PACKER_AVX2)
+	const char *path = "AVX2";
+#elif defined(GLYPH_PACKER_SSE2)
+	const char *path = "SSE2";
+#else
+	const char *path = "scalar fallback";
+#endif
+	double characters = (double)lines.num_characters * BENCH_ITERATIONS;
+	printf("scalar: %.3f ns/char\n", scalar_ns / characters);
+	printf("%s: %.3f ns/char (%.2fx)\n", path, simd_ns / characters, (double)scalar_ns / (double)simd_ns);
+
+	bool identical = memcmp(scalar_instances, instances, lines.num_characters * sizeof(GlyphInstance)) == 0;
+	if(!identical) {
+		printf("The packed instances differ from the scalar path\n");
+	}
+
+	free(instances);
+	free(scalar_instances);
+	free(lines.content);
+	free(lines.offsets);
+	free(lines.lengths);
+	return identical ? 0 : 1;
+}
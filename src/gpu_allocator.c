@@ -0,0 +1,377 @@
+#include "gpu_allocator.h"
+
+static GpuAllocator gpu_allocator_create(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties,
+	u64 buffer_image_granularity) {
+	u64 min_buddy_size = GPU_MIN_BUDDY_SIZE;
+	while(min_buddy_size < buffer_image_granularity) {
+		min_buddy_size *= 2;
+	}
+
+	u32 max_buddy_order = 0;
+	while((min_buddy_size << max_buddy_order) < GPU_BLOCK_SIZE) {
+		++max_buddy_order;
+	}
+	assert(max_buddy_order < GPU_MAX_BUDDY_ORDERS);
+
+	return (GpuAllocator) {
+		.device = device,
+		.memory_properties = memory_properties,
+		.min_buddy_size = min_buddy_size,
+		.max_buddy_order = max_buddy_order
+	};
+}
+
+// Function from Vulkan spec 1.0.183
+static u32 try_find_memory_type_index(VkPhysicalDeviceMemoryProperties memory_properties,
+	u32 memory_type_bits_requirements,
+	VkMemoryPropertyFlags required_properties) {
+	u32 memory_count = memory_properties.memoryTypeCount;
+
+	for(u32 memory_index = 0; memory_index < memory_count; ++memory_index) {
+		VkMemoryPropertyFlags properties = memory_properties.memoryTypes[memory_index].propertyFlags;
+		bool is_required_memory_type = memory_type_bits_requirements & (1 << memory_index);
+		bool has_required_properties = (properties & required_properties) == required_properties;
+
+		if(is_required_memory_type && has_required_properties) {
+			return (u32)memory_index;
+		}
+	}
+
+	return UINT32_MAX;
+}
+
+static u64 gpu_align_up(u64 value, u64 alignment) {
+	return ((value + alignment - 1) / alignment) * alignment;
+}
+
+// Host-visible memory is mapped for as long as it lives, a VkDeviceMemory can only be mapped once
+static VkDeviceMemory gpu_allocate_device_memory(GpuAllocator *allocator, u32 memory_type_index, u64 size,
+	void **mapped) {
+	VkMemoryAllocateInfo memory_allocate_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = size,
+		.memoryTypeIndex = memory_type_index
+	};
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VK_CHECK(vkAllocateMemory(allocator->device, &memory_allocate_info, NULL, &memory));
+
+	*mapped = NULL;
+	if(allocator->memory_properties.memoryTypes[memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		VK_CHECK(vkMapMemory(allocator->device, memory, 0, VK_WHOLE_SIZE, 0, mapped));
+	}
+
+	++allocator->device_memory_count;
+	allocator->reserved_bytes += size;
+	return memory;
+}
+
+static void gpu_free_device_memory(GpuAllocator *allocator, VkDeviceMemory memory, u64 size) {
+	vkFreeMemory(allocator->device, memory, NULL);
+	--allocator->device_memory_count;
+	allocator->reserved_bytes -= size;
+}
+
+static void gpu_buddy_push(GpuBuddyBlock *block, u32 order, u32 offset) {
+	if(block->free_counts[order] == block->free_capacities[order]) {
+		block->free_capacities[order] = MAX(block->free_capacities[order] * 2, 8);
+		block->free_lists[order] = (u32 *)realloc(block->free_lists[order], block->free_capacities[order] * sizeof(u32));
+		assert(block->free_lists[order]);
+	}
+	block->free_lists[order][block->free_counts[order]++] = offset;
+}
+
+// Free lists stay short, every split leaves at most one free buddy per order behind
+static bool gpu_buddy_remove(GpuBuddyBlock *block, u32 order, u32 offset) {
+	for(u32 i = 0; i < block->free_counts[order]; ++i) {
+		if(block->free_lists[order][i] == offset) {
+			block->free_lists[order][i] = block->free_lists[order][--block->free_counts[order]];
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool gpu_buddy_allocate(GpuAllocator *allocator, GpuBuddyBlock *block, u32 order, u32 *offset) {
+	u32 free_order = order;
+	while(free_order <= allocator->max_buddy_order && block->free_counts[free_order] == 0) {
+		++free_order;
+	}
+	if(free_order > allocator->max_buddy_order) {
+		return false;
+	}
+
+	// Split the smallest free buddy that fits until it has the requested order
+	*offset = block->free_lists[free_order][--block->free_counts[free_order]];
+	while(free_order > order) {
+		--free_order;
+		gpu_buddy_push(block, free_order, *offset + (1u << free_order));
+	}
+	block->used_size += allocator->min_buddy_size << order;
+	return true;
+}
+
+static void gpu_buddy_free(GpuAllocator *allocator, GpuBuddyBlock *block, u32 order, u32 offset) {
+	block->used_size -= allocator->min_buddy_size << order;
+
+	// Merge with the buddy for as long as it is free as well
+	while(order < allocator->max_buddy_order && gpu_buddy_remove(block, order, offset ^ (1u << order))) {
+		offset &= ~(1u << order);
+		++order;
+	}
+	gpu_buddy_push(block, order, offset);
+}
+
+static GpuAllocation gpu_allocate_dedicated(GpuAllocator *allocator, u32 memory_type_index, u64 size) {
+	void *mapped;
+	VkDeviceMemory memory = gpu_allocate_device_memory(allocator, memory_type_index, size, &mapped);
+	return (GpuAllocation) {
+		.memory = memory,
+		.offset = 0,
+		.size = size,
+		.mapped = mapped,
+		.memory_type_index = memory_type_index,
+		.strategy = GPU_ALLOCATION_DEDICATED
+	};
+}
+
+static GpuAllocation gpu_allocate_buddy(GpuAllocator *allocator, u32 memory_type_index,
+	VkMemoryRequirements requirements) {
+	// Buddies are aligned to their own size, which covers every power of two alignment up to it
+	u64 size = MAX(requirements.size, requirements.alignment);
+	u32 order = 0;
+	while((allocator->min_buddy_size << order) < size) {
+		++order;
+	}
+
+	GpuMemoryPool *pool = &allocator->pools[memory_type_index];
+	u32 block_index = UINT32_MAX;
+	u32 offset = 0;
+	for(u32 i = 0; i < pool->num_blocks; ++i) {
+		if(pool->blocks[i].memory != VK_NULL_HANDLE && gpu_buddy_allocate(allocator, &pool->blocks[i], order, &offset)) {
+			block_index = i;
+			break;
+		}
+	}
+
+	if(block_index == UINT32_MAX) {
+		for(u32 i = 0; i < pool->num_blocks; ++i) {
+			if(pool->blocks[i].memory == VK_NULL_HANDLE) {
+				block_index = i;
+				break;
+			}
+		}
+		if(block_index == UINT32_MAX) {
+			block_index = pool->num_blocks++;
+			pool->blocks = (GpuBuddyBlock *)realloc(pool->blocks, pool->num_blocks * sizeof(GpuBuddyBlock));
+			assert(pool->blocks);
+			pool->blocks[block_index] = (GpuBuddyBlock) { 0 };
+		}
+
+		GpuBuddyBlock *block = &pool->blocks[block_index];
+		block->memory = gpu_allocate_device_memory(allocator, memory_type_index, GPU_BLOCK_SIZE, &block->mapped);
+		gpu_buddy_push(block, allocator->max_buddy_order, 0);
+		bool allocated = gpu_buddy_allocate(allocator, block, order, &offset);
+		assert(allocated);
+	}
+
+	GpuBuddyBlock *block = &pool->blocks[block_index];
+	u64 byte_offset = (u64)offset * allocator->min_buddy_size;
+	return (GpuAllocation) {
+		.memory = block->memory,
+		.offset = byte_offset,
+		.size = allocator->min_buddy_size << order,
+		.mapped = block->mapped ? (u8 *)block->mapped + byte_offset : NULL,
+		.memory_type_index = memory_type_index,
+		.page_index = block_index,
+		.order = order,
+		.strategy = GPU_ALLOCATION_BUDDY
+	};
+}
+
+static GpuAllocation gpu_allocate_linear(GpuAllocator *allocator, u32 memory_type_index,
+	VkMemoryRequirements requirements) {
+	GpuMemoryPool *pool = &allocator->pools[memory_type_index];
+	GpuLinearPage *page = pool->num_pages > 0 ? &pool->pages[pool->current_page] : NULL;
+	u64 offset = page ? gpu_align_up(page->head, requirements.alignment) : 0;
+
+	if(!page || page->memory == VK_NULL_HANDLE || offset + requirements.size > GPU_LINEAR_PAGE_SIZE) {
+		// Move on to an empty page, or a new one if all of them are still in use
+		u32 page_index = UINT32_MAX;
+		for(u32 i = 0; i < pool->num_pages; ++i) {
+			if(pool->pages[i].live_allocations == 0) {
+				page_index = i;
+				break;
+			}
+		}
+		if(page_index == UINT32_MAX) {
+			page_index = pool->num_pages++;
+			pool->pages = (GpuLinearPage *)realloc(pool->pages, pool->num_pages * sizeof(GpuLinearPage));
+			assert(pool->pages);
+			pool->pages[page_index] = (GpuLinearPage) { 0 };
+		}
+
+		page = &pool->pages[page_index];
+		if(page->memory == VK_NULL_HANDLE) {
+			page->memory = gpu_allocate_device_memory(allocator, memory_type_index, GPU_LINEAR_PAGE_SIZE,
+				&page->mapped);
+		}
+		page->head = 0;
+		pool->current_page = page_index;
+		offset = 0;
+	}
+
+	page->head = offset + requirements.size;
+	++page->live_allocations;
+	return (GpuAllocation) {
+		.memory = page->memory,
+		.offset = offset,
+		.size = requirements.size,
+		.mapped = page->mapped ? (u8 *)page->mapped + offset : NULL,
+		.memory_type_index = memory_type_index,
+		.page_index = pool->current_page,
+		.strategy = GPU_ALLOCATION_LINEAR
+	};
+}
+
+static GpuAllocation gpu_allocate(GpuAllocator *allocator, VkMemoryRequirements requirements,
+	VkMemoryPropertyFlags required_properties, VkMemoryPropertyFlags preferred_properties, GpuLifetime lifetime) {
+	u32 memory_type_index = try_find_memory_type_index(allocator->memory_properties,
+		requirements.memoryTypeBits, required_properties | preferred_properties);
+	if(memory_type_index == UINT32_MAX) {
+		memory_type_index = try_find_memory_type_index(allocator->memory_properties,
+			requirements.memoryTypeBits, required_properties);
+	}
+	// Failed to find memory type
+	assert(memory_type_index != UINT32_MAX);
+
+	GpuAllocation allocation;
+	if(lifetime == GPU_LIFETIME_TRANSIENT && requirements.size <= GPU_LINEAR_PAGE_SIZE) {
+		allocation = gpu_allocate_linear(allocator, memory_type_index, requirements);
+	}
+	else if(lifetime == GPU_LIFETIME_LONG && MAX(requirements.size, requirements.alignment) <= GPU_BLOCK_SIZE / 2) {
+		allocation = gpu_allocate_buddy(allocator, memory_type_index, requirements);
+	}
+	else {
+		allocation = gpu_allocate_dedicated(allocator, memory_type_index,
+			gpu_align_up(requirements.size, requirements.alignment));
+	}
+
+	allocation.requested_size = requirements.size;
+	++allocator->allocation_count;
+	allocator->allocated_bytes += allocation.size;
+	allocator->requested_bytes += allocation.requested_size;
+	return allocation;
+}
+
+static void gpu_free(GpuAllocator *allocator, GpuAllocation *allocation) {
+	if(allocation->memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	GpuMemoryPool *pool = &allocator->pools[allocation->memory_type_index];
+	switch(allocation->strategy) {
+	case GPU_ALLOCATION_BUDDY: {
+		GpuBuddyBlock *block = &pool->blocks[allocation->page_index];
+		gpu_buddy_free(allocator, block, allocation->order, (u32)(allocation->offset / allocator->min_buddy_size));
+
+		// Keep the first block around, the others go back to the driver once empty
+		if(block->used_size == 0 && allocation->page_index > 0) {
+			gpu_free_device_memory(allocator, block->memory, GPU_BLOCK_SIZE);
+			for(u32 i = 0; i < GPU_MAX_BUDDY_ORDERS; ++i) {
+				free(block->free_lists[i]);
+			}
+			*block = (GpuBuddyBlock) { 0 };
+		}
+	} break;
+	case GPU_ALLOCATION_LINEAR: {
+		GpuLinearPage *page = &pool->pages[allocation->page_index];
+		assert(page->live_allocations > 0);
+		if(--page->live_allocations == 0) {
+			page->head = 0;
+			if(allocation->page_index != pool->current_page) {
+				gpu_free_device_memory(allocator, page->memory, GPU_LINEAR_PAGE_SIZE);
+				*page = (GpuLinearPage) { 0 };
+			}
+		}
+	} break;
+	case GPU_ALLOCATION_DEDICATED: {
+		gpu_free_device_memory(allocator, allocation->memory, allocation->size);
+	} break;
+	}
+
+	--allocator->allocation_count;
+	allocator->allocated_bytes -= allocation->size;
+	allocator->requested_bytes -= allocation->requested_size;
+	*allocation = (GpuAllocation) { 0 };
+}
+
+static void gpu_allocator_destroy(GpuAllocator *allocator) {
+	for(u32 i = 0; i < VK_MAX_MEMORY_TYPES; ++i) {
+		GpuMemoryPool *pool = &allocator->pools[i];
+		for(u32 j = 0; j < pool->num_blocks; ++j) {
+			if(pool->blocks[j].memory != VK_NULL_HANDLE) {
+				gpu_free_device_memory(allocator, pool->blocks[j].memory, GPU_BLOCK_SIZE);
+			}
+			for(u32 k = 0; k < GPU_MAX_BUDDY_ORDERS; ++k) {
+				free(pool->blocks[j].free_lists[k]);
+			}
+		}
+		for(u32 j = 0; j < pool->num_pages; ++j) {
+			if(pool->pages[j].memory != VK_NULL_HANDLE) {
+				gpu_free_device_memory(allocator, pool->pages[j].memory, GPU_LINEAR_PAGE_SIZE);
+			}
+		}
+		free(pool->blocks);
+		free(pool->pages);
+	}
+
+	// Anything left over is a dedicated allocation that was never freed
+	assert(allocator->device_memory_count == 0);
+	*allocator = (GpuAllocator) { 0 };
+}
+
+static GpuAllocatorStats gpu_allocator_get_stats(GpuAllocator *allocator) {
+	GpuAllocatorStats stats = {
+		.device_memory_count = allocator->device_memory_count,
+		.allocation_count = allocator->allocation_count,
+		.reserved_bytes = allocator->reserved_bytes,
+		.allocated_bytes = allocator->allocated_bytes,
+		.requested_bytes = allocator->requested_bytes
+	};
+
+	for(u32 i = 0; i < VK_MAX_MEMORY_TYPES; ++i) {
+		GpuMemoryPool *pool = &allocator->pools[i];
+		for(u32 j = 0; j < pool->num_blocks; ++j) {
+			GpuBuddyBlock *block = &pool->blocks[j];
+			if(block->memory == VK_NULL_HANDLE) {
+				continue;
+			}
+
+			stats.free_bytes += GPU_BLOCK_SIZE - block->used_size;
+			for(u32 order = allocator->max_buddy_order + 1; order-- > 0;) {
+				if(block->free_counts[order] > 0) {
+					stats.largest_free_range = MAX(stats.largest_free_range, allocator->min_buddy_size << order);
+					break;
+				}
+			}
+		}
+	}
+
+	stats.internal_fragmentation = stats.allocated_bytes > 0 ?
+		1.0f - (float)stats.requested_bytes / stats.allocated_bytes : 0.0f;
+	stats.external_fragmentation = stats.free_bytes > 0 ?
+		1.0f - (float)stats.largest_free_range / stats.free_bytes : 0.0f;
+	return stats;
+}
+
+static void gpu_allocator_print_stats(GpuAllocator *allocator) {
+	GpuAllocatorStats stats = gpu_allocator_get_stats(allocator);
+	printf("GPU memory: %u allocations in %u device allocations, %.2f MiB reserved, %.2f MiB allocated "
+		"(%.2f MiB requested), %.2f MiB free, largest free range %.2f MiB, "
+		"internal fragmentation %.1f%%, external fragmentation %.1f%%\n",
+		stats.allocation_count, stats.device_memory_count,
+		stats.reserved_bytes / 1048576.0, stats.allocated_bytes / 1048576.0,
+		stats.requested_bytes / 1048576.0, stats.free_bytes / 1048576.0,
+		stats.largest_free_range / 1048576.0,
+		stats.internal_fragmentation * 100.0f, stats.external_fragmentation * 100.0f);
+}
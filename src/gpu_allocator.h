@@ -0,0 +1,102 @@
+#pragma once
+
+// Device memory is allocated in large blocks per memory type and sub-allocated from there,
+// vkAllocateMemory is only called when a block or page runs out. Long-lived resources use a
+// buddy allocator inside the blocks, transient ones (staging buffers) bump-allocate from linear
+// pages that are reset once everything in them has been freed. Allocations too large for either
+// get their own device memory.
+#define GPU_BLOCK_SIZE (64ull << 20)
+#define GPU_LINEAR_PAGE_SIZE (8ull << 20)
+#define GPU_MIN_BUDDY_SIZE 256
+#define GPU_MAX_BUDDY_ORDERS 32
+
+typedef enum GpuLifetime {
+	GPU_LIFETIME_LONG,
+	GPU_LIFETIME_TRANSIENT
+} GpuLifetime;
+
+typedef enum GpuAllocationStrategy {
+	GPU_ALLOCATION_BUDDY,
+	GPU_ALLOCATION_LINEAR,
+	GPU_ALLOCATION_DEDICATED
+} GpuAllocationStrategy;
+
+typedef struct GpuAllocation {
+	VkDeviceMemory memory;
+	u64 offset;
+	u64 size; // Bytes reserved for the allocation, at least the requested size
+	u64 requested_size;
+	void *mapped; // NULL unless the memory type is host-visible
+	u32 memory_type_index;
+	u32 page_index; // Block or linear page the allocation lives in
+	u32 order;
+	GpuAllocationStrategy strategy;
+} GpuAllocation;
+
+// Free lists hold offsets in units of the smallest buddy size, a buddy of order k spans 2^k units
+typedef struct GpuBuddyBlock {
+	VkDeviceMemory memory; // VK_NULL_HANDLE for a released block whose slot can be reused
+	void *mapped;
+	u32 *free_lists[GPU_MAX_BUDDY_ORDERS];
+	u32 free_counts[GPU_MAX_BUDDY_ORDERS];
+	u32 free_capacities[GPU_MAX_BUDDY_ORDERS];
+	u64 used_size;
+} GpuBuddyBlock;
+
+typedef struct GpuLinearPage {
+	VkDeviceMemory memory; // VK_NULL_HANDLE for a released page whose slot can be reused
+	void *mapped;
+	u64 head;
+	u32 live_allocations;
+} GpuLinearPage;
+
+typedef struct GpuMemoryPool {
+	GpuBuddyBlock *blocks;
+	u32 num_blocks;
+	GpuLinearPage *pages;
+	u32 num_pages;
+	u32 current_page;
+} GpuMemoryPool;
+
+typedef struct GpuAllocator {
+	VkDevice device;
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	// The smallest buddy is at least bufferImageGranularity, so buffers and optimally
+	// tiled images never share a granularity page inside a block
+	u64 min_buddy_size;
+	u32 max_buddy_order;
+	GpuMemoryPool pools[VK_MAX_MEMORY_TYPES];
+
+	u32 device_memory_count;
+	u32 allocation_count;
+	u64 reserved_bytes;
+	u64 allocated_bytes;
+	u64 requested_bytes;
+} GpuAllocator;
+
+typedef struct GpuAllocatorStats {
+	u32 device_memory_count; // Live vkAllocateMemory allocations
+	u32 allocation_count;
+	u64 reserved_bytes; // Device memory held by blocks, pages and dedicated allocations
+	u64 allocated_bytes; // Handed out after rounding, the difference to requested_bytes is internal waste
+	u64 requested_bytes;
+	u64 free_bytes; // Free space in buddy blocks
+	u64 largest_free_range;
+	float internal_fragmentation; // 1 - requested / allocated
+	float external_fragmentation; // 1 - largest free range / free bytes, 0 when all free space is contiguous
+} GpuAllocatorStats;
+
+static GpuAllocator gpu_allocator_create(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties,
+	u64 buffer_image_granularity);
+static void gpu_allocator_destroy(GpuAllocator *allocator);
+
+// The preferred properties are only used if a memory type with both them and the required properties exists
+static GpuAllocation gpu_allocate(GpuAllocator *allocator, VkMemoryRequirements requirements,
+	VkMemoryPropertyFlags required_properties, VkMemoryPropertyFlags preferred_properties, GpuLifetime lifetime);
+static void gpu_free(GpuAllocator *allocator, GpuAllocation *allocation);
+
+static u32 try_find_memory_type_index(VkPhysicalDeviceMemoryProperties memory_properties,
+	u32 memory_type_bits_requirements, VkMemoryPropertyFlags required_properties);
+
+static GpuAllocatorStats gpu_allocator_get_stats(GpuAllocator *allocator);
+static void gpu_allocator_print_stats(GpuAllocator *allocator);
@@ -0,0 +1,206 @@
+#include "gpu_profiler.h"
+
+static const char *GPU_METRIC_NAMES[GPU_METRIC_COUNT] = {
+	[GPU_METRIC_RENDER_PASS_TIME] = "Render pass",
+	[GPU_METRIC_VERTEX_INVOCATIONS] = "Vertex invocations",
+	[GPU_METRIC_FRAGMENT_INVOCATIONS] = "Fragment invocations",
+	[GPU_METRIC_GLYPH_RASTERIZATION_TIME] = "Glyph rasterization",
+	[GPU_METRIC_GLYPH_COMPUTE_INVOCATIONS] = "Glyph compute invocations"
+};
+
+static bool is_gpu_time_metric(GpuMetric metric) {
+	return metric == GPU_METRIC_RENDER_PASS_TIME || metric == GPU_METRIC_GLYPH_RASTERIZATION_TIME;
+}
+
+static GpuProfiler gpu_profiler_create(VkDevice device, float timestamp_period,
+	u32 graphics_timestamp_valid_bits, u32 compute_timestamp_valid_bits, bool has_pipeline_statistics) {
+	GpuProfiler profiler = {
+		.device = device,
+		.timestamp_period_ns = timestamp_period,
+		.graphics_timestamp_valid_bits = graphics_timestamp_valid_bits,
+		.compute_timestamp_valid_bits = compute_timestamp_valid_bits,
+		.has_pipeline_statistics = has_pipeline_statistics
+	};
+	profiler.glyph_queries = gpu_query_set_create(&profiler, 1, true);
+	return profiler;
+}
+
+static void gpu_profiler_destroy(GpuProfiler *profiler) {
+	gpu_query_set_destroy(profiler->device, &profiler->glyph_queries);
+}
+
+static GpuQuerySet gpu_query_set_create(GpuProfiler *profiler, u32 num_slots, bool compute) {
+	GpuQuerySet query_set = {
+		.num_slots = num_slots,
+		.pending = (bool *)calloc(num_slots, sizeof(bool)),
+		.time_metric = compute ? GPU_METRIC_GLYPH_RASTERIZATION_TIME : GPU_METRIC_RENDER_PASS_TIME,
+		.first_statistics_metric = compute ? GPU_METRIC_GLYPH_COMPUTE_INVOCATIONS : GPU_METRIC_VERTEX_INVOCATIONS
+	};
+	assert(query_set.pending);
+
+	u32 valid_bits = compute ? profiler->compute_timestamp_valid_bits : profiler->graphics_timestamp_valid_bits;
+	if(valid_bits > 0) {
+		query_set.timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+		VkQueryPoolCreateInfo timestamp_pool_info = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_TIMESTAMP,
+			.queryCount = num_slots * 2
+		};
+		VK_CHECK(vkCreateQueryPool(profiler->device, &timestamp_pool_info, NULL, &query_set.timestamp_pool));
+	}
+
+	// A statistics query may only count operations the queue of its command buffer supports
+	if(profiler->has_pipeline_statistics) {
+		VkQueryPipelineStatisticFlags statistics = compute ?
+			VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT :
+			VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+			VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+		query_set.num_statistics = compute ? 1 : 2;
+		assert(query_set.num_statistics <= GPU_PROFILER_MAX_STATISTICS);
+
+		VkQueryPoolCreateInfo statistics_pool_info = {
+			.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+			.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+			.queryCount = num_slots,
+			.pipelineStatistics = statistics
+		};
+		VK_CHECK(vkCreateQueryPool(profiler->device, &statistics_pool_info, NULL, &query_set.statistics_pool));
+	}
+
+	return query_set;
+}
+
+static void gpu_query_set_destroy(VkDevice device, GpuQuerySet *query_set) {
+	if(query_set->timestamp_pool) {
+		vkDestroyQueryPool(device, query_set->timestamp_pool, NULL);
+	}
+	if(query_set->statistics_pool) {
+		vkDestroyQueryPool(device, query_set->statistics_pool, NULL);
+	}
+	free(query_set->pending);
+	*query_set = (GpuQuerySet) { 0 };
+}
+
+static void gpu_query_begin(GpuQuerySet *query_set, VkCommandBuffer command_buffer, u32 slot) {
+	assert(slot < query_set->num_slots);
+	if(query_set->timestamp_pool) {
+		vkCmdResetQueryPool(command_buffer, query_set->timestamp_pool, slot * 2, 2);
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_set->timestamp_pool, slot * 2);
+	}
+	if(query_set->statistics_pool) {
+		vkCmdResetQueryPool(command_buffer, query_set->statistics_pool, slot, 1);
+		vkCmdBeginQuery(command_buffer, query_set->statistics_pool, slot, 0);
+	}
+}
+
+static void gpu_query_end(GpuQuerySet *query_set, VkCommandBuffer command_buffer, u32 slot) {
+	assert(slot < query_set->num_slots);
+	if(query_set->statistics_pool) {
+		vkCmdEndQuery(command_buffer, query_set->statistics_pool, slot);
+	}
+	if(query_set->timestamp_pool) {
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_set->timestamp_pool,
+			slot * 2 + 1);
+	}
+}
+
+static void gpu_query_submitted(GpuQuerySet *query_set, u32 slot) {
+	assert(slot < query_set->num_slots);
+	query_set->pending[slot] = query_set->timestamp_pool || query_set->statistics_pool;
+}
+
+static void add_gpu_metric_sample(GpuProfiler *profiler, GpuMetric metric, double sample) {
+	GpuMetricHistory *history = &profiler->metrics[metric];
+	history->samples[history->next] = sample;
+	history->next = (history->next + 1) % GPU_PROFILER_HISTORY;
+	history->count = MIN(history->count + 1, GPU_PROFILER_HISTORY);
+}
+
+static void gpu_profiler_collect(GpuProfiler *profiler, GpuQuerySet *query_set, u32 slot) {
+	assert(slot < query_set->num_slots);
+	if(!query_set->pending[slot]) {
+		return;
+	}
+
+	// Every result is followed by its availability, so an unfinished query is
+	// reported as such instead of blocking until it is written
+	VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+	u64 timestamps[2][2] = { 0 };
+	if(query_set->timestamp_pool) {
+		VkResult result = vkGetQueryPoolResults(profiler->device, query_set->timestamp_pool, slot * 2, 2,
+			sizeof(timestamps), timestamps, sizeof(timestamps[0]), flags);
+		if(result != VK_SUCCESS || !timestamps[0][1] || !timestamps[1][1]) {
+			return;
+		}
+	}
+
+	u64 statistics[GPU_PROFILER_MAX_STATISTICS + 1] = { 0 };
+	if(query_set->statistics_pool) {
+		u64 stride = (query_set->num_statistics + 1) * sizeof(u64);
+		VkResult result = vkGetQueryPoolResults(profiler->device, query_set->statistics_pool, slot, 1,
+			stride, statistics, stride, flags);
+		if(result != VK_SUCCESS || !statistics[query_set->num_statistics]) {
+			return;
+		}
+	}
+	query_set->pending[slot] = false;
+
+	if(query_set->timestamp_pool) {
+		u64 ticks = (timestamps[1][0] - timestamps[0][0]) & query_set->timestamp_mask;
+		add_gpu_metric_sample(profiler, query_set->time_metric, (double)ticks * profiler->timestamp_period_ns / 1e6);
+	}
+	for(u32 i = 0; query_set->statistics_pool && i < query_set->num_statistics; ++i) {
+		add_gpu_metric_sample(profiler, query_set->first_statistics_metric + i, (double)statistics[i]);
+	}
+}
+
+static void gpu_profiler_end_frame(GpuProfiler *profiler) {
+	if(profiler->summary_interval == 0) {
+		return;
+	}
+
+	if(++profiler->frames_since_summary >= profiler->summary_interval) {
+		gpu_profiler_write_summary(profiler, stdout);
+		profiler->frames_since_summary = 0;
+	}
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void gpu_profiler_write_summary(GpuProfiler *profiler, FILE *file) {
+	double sorted[GPU_PROFILER_HISTORY];
+	for(u32 i = 0; i < GPU_METRIC_COUNT; ++i) {
+		GpuMetricHistory *history = &profiler->metrics[i];
+		if(history->count == 0) {
+			continue;
+		}
+
+		memcpy(sorted, history->samples, history->count * sizeof(double));
+		qsort(sorted, history->count, sizeof(double), compare_doubles);
+		double p50 = sorted[(history->count - 1) * 50 / 100];
+		double p99 = sorted[(history->count - 1) * 99 / 100];
+		if(is_gpu_time_metric(i)) {
+			fprintf(file, "%s: p50 %.3f ms, p99 %.3f ms (%u samples)\n", GPU_METRIC_NAMES[i], p50, p99,
+				history->count);
+		}
+		else {
+			fprintf(file, "%s: p50 %.0f, p99 %.0f (%u samples)\n", GPU_METRIC_NAMES[i], p50, p99, history->count);
+		}
+	}
+}
+
+static bool gpu_profiler_dump_summary(GpuProfiler *profiler, const char *path) {
+	FILE *file = fopen(path, "w");
+	if(!file) {
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	gpu_profiler_write_summary(profiler, file);
+	return fclose(file) == 0;
+}
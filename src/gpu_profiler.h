@@ -0,0 +1,71 @@
+#pragma once
+
+// GPU timings and pipeline statistics from query pools. Queries are only read once the
+// timeline value of the work that wrote them has been reached, a few frames later, so reading
+// them never stalls. Every sample goes into a rolling window per metric that is summarized
+// as p50 and p99.
+#define GPU_PROFILER_HISTORY 1024 // Samples per metric in the rolling window
+#define GPU_PROFILER_SUMMARY_INTERVAL 600 // Frames between periodic summaries, when they are enabled
+#define GPU_PROFILER_MAX_STATISTICS 2
+
+typedef enum GpuMetric {
+	GPU_METRIC_RENDER_PASS_TIME,
+	GPU_METRIC_VERTEX_INVOCATIONS,
+	GPU_METRIC_FRAGMENT_INVOCATIONS,
+	GPU_METRIC_GLYPH_RASTERIZATION_TIME,
+	GPU_METRIC_GLYPH_COMPUTE_INVOCATIONS,
+	GPU_METRIC_COUNT
+} GpuMetric;
+
+typedef struct GpuMetricHistory {
+	double samples[GPU_PROFILER_HISTORY];
+	u32 count;
+	u32 next;
+} GpuMetricHistory;
+
+// Queries for a number of slots that are each written by one command buffer, e.g. one slot per
+// swapchain image. A slot must not be recorded again before the results of its last submission
+// were collected or its command buffer finished executing.
+typedef struct GpuQuerySet {
+	VkQueryPool timestamp_pool; // Two timestamps per slot, VK_NULL_HANDLE if the queue has no timestamps
+	VkQueryPool statistics_pool; // VK_NULL_HANDLE if pipeline statistics are not supported
+	u64 timestamp_mask;
+	u32 num_statistics; // Counters per statistics query
+	u32 num_slots;
+	bool *pending; // Submitted, but the results were not collected yet
+	GpuMetric time_metric;
+	GpuMetric first_statistics_metric;
+} GpuQuerySet;
+
+typedef struct GpuProfiler {
+	VkDevice device;
+	double timestamp_period_ns;
+	u32 graphics_timestamp_valid_bits;
+	u32 compute_timestamp_valid_bits;
+	bool has_pipeline_statistics;
+
+	GpuQuerySet glyph_queries; // The single dispatch that rasterizes the glyph atlas
+	GpuMetricHistory metrics[GPU_METRIC_COUNT];
+
+	u32 summary_interval; // Frames between printed summaries, 0 disables them
+	u32 frames_since_summary;
+} GpuProfiler;
+
+static GpuProfiler gpu_profiler_create(VkDevice device, float timestamp_period,
+	u32 graphics_timestamp_valid_bits, u32 compute_timestamp_valid_bits, bool has_pipeline_statistics);
+static void gpu_profiler_destroy(GpuProfiler *profiler);
+
+static GpuQuerySet gpu_query_set_create(GpuProfiler *profiler, u32 num_slots, bool compute);
+static void gpu_query_set_destroy(VkDevice device, GpuQuerySet *query_set);
+
+// Both have to be recorded outside of a render pass
+static void gpu_query_begin(GpuQuerySet *query_set, VkCommandBuffer command_buffer, u32 slot);
+static void gpu_query_end(GpuQuerySet *query_set, VkCommandBuffer command_buffer, u32 slot);
+static void gpu_query_submitted(GpuQuerySet *query_set, u32 slot);
+// Adds the results of the slot to the metrics if they are available, never waits for them
+static void gpu_profiler_collect(GpuProfiler *profiler, GpuQuerySet *query_set, u32 slot);
+
+// Counts a presented frame and prints a summary every summary_interval frames
+static void gpu_profiler_end_frame(GpuProfiler *profiler);
+static void gpu_profiler_write_summary(GpuProfiler *profiler, FILE *file);
+static bool gpu_profiler_dump_summary(GpuProfiler *profiler, const char *path);
@@ -1,12 +1,291 @@
 #include "common_types.h"
 #include "shared_types.h"
 
+#include "platform.c"
+#include "trace.c"
+#include "frame_queue.c"
 #include "editor.c"
+#include "glyph_packer.c"
+#include "gpu_allocator.c"
+#include "gpu_profiler.c"
 #include "renderer.c"
 
+// --present-mode=fifo|mailbox|immediate, FIFO saves the most power and is the default
+static VkPresentModeKHR get_present_mode_argument(const char *arguments, VkPresentModeKHR present_mode) {
+    const char *argument = strstr(arguments, "--present-mode=");
+    if(!argument) {
+        return present_mode;
+    }
+
+    argument += strlen("--present-mode=");
+    if(strncmp(argument, "fifo", 4) == 0) {
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+    if(strncmp(argument, "mailbox", 7) == 0) {
+        return VK_PRESENT_MODE_MAILBOX_KHR;
+    }
+    if(strncmp(argument, "immediate", 9) == 0) {
+        return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    }
+    printf("Unknown present mode: %s\n", argument);
+    return present_mode;
+}
+
+// --glyph-rasterizer=lines|curves, lines is the default and curves rasterizes the quadratic
+// curves of the outlines directly, e.g. to compare their timings with --gpu-stats
+static GlyphRasterizer get_glyph_rasterizer_argument(const char *arguments, GlyphRasterizer rasterizer) {
+    const char *argument = strstr(arguments, "--glyph-rasterizer=");
+    if(!argument) {
+        return rasterizer;
+    }
+
+    argument += strlen("--glyph-rasterizer=");
+    if(strncmp(argument, "lines", 5) == 0) {
+        return GLYPH_RASTERIZER_LINES;
+    }
+    if(strncmp(argument, "curves", 6) == 0) {
+        return GLYPH_RASTERIZER_CURVES;
+    }
+    printf("Unknown glyph rasterizer: %s\n", argument);
+    return rasterizer;
+}
+
+#define DEFAULT_HEADLESS_WIDTH 1920
+#define DEFAULT_HEADLESS_HEIGHT 1080
+#define DEFAULT_HEADLESS_FRAMES 600
+
+typedef struct HeadlessOptions {
+    bool enabled;
+    u32 width;
+    u32 height;
+    u32 num_frames;
+    char file_path[FILENAME_MAX];
+    char dump_path[FILENAME_MAX];
+} HeadlessOptions;
+
+#define MAX_DEVICE_OVERRIDE_LENGTH 256
+
+// --trace=path records zones from startup on and writes them as Chrome trace JSON on exit
+static void start_trace(const char *path) {
+    if(path[0]) {
+        trace_enable();
+        trace_set_thread_name("main");
+    }
+}
+
+static void finish_trace(const char *path) {
+    if(path[0]) {
+        trace_write_chrome_json(path);
+        trace_destroy();
+    }
+}
+
+// Copies the value of --name=value up to the next space
+static void copy_argument_value(const char *arguments, const char *name, char *value, u64 value_size) {
+    const char *argument = strstr(arguments, name);
+    if(!argument) {
+        return;
+    }
+
+    argument += strlen(name);
+    u64 length = 0;
+    while(argument[length] && argument[length] != ' ' && length + 1 < value_size) {
+        value[length] = argument[length];
+        ++length;
+    }
+    value[length] = '\0';
+}
+
+// --headless[=WIDTHxHEIGHT] --frames=N --file=path --dump=path.ppm
+static HeadlessOptions get_headless_arguments(const char *arguments, HeadlessOptions options) {
+    const char *argument = strstr(arguments, "--headless");
+    if(argument) {
+        options.enabled = true;
+        u32 width, height;
+        if(sscanf(argument, "--headless=%ux%u", &width, &height) == 2 && width > 0 && height > 0) {
+            options.width = width;
+            options.height = height;
+        }
+    }
+
+    argument = strstr(arguments, "--frames=");
+    if(argument) {
+        sscanf(argument, "--frames=%u", &options.num_frames);
+    }
+    copy_argument_value(arguments, "--file=", options.file_path, sizeof(options.file_path));
+    copy_argument_value(arguments, "--dump=", options.dump_path, sizeof(options.dump_path));
+    return options;
+}
+
+typedef struct GpuStatsOptions {
+    bool enabled;
+    char path[FILENAME_MAX];
+} GpuStatsOptions;
+
+// --gpu-stats[=path] prints GPU timings and pipeline statistics every GPU_PROFILER_SUMMARY_INTERVAL
+// frames and writes the final summary to path on exit
+static GpuStatsOptions get_gpu_stats_arguments(const char *arguments, GpuStatsOptions options) {
+    if(strstr(arguments, "--gpu-stats")) {
+        options.enabled = true;
+    }
+    copy_argument_value(arguments, "--gpu-stats=", options.path, sizeof(options.path));
+    return options;
+}
+
+static void start_gpu_stats(Renderer *renderer, GpuStatsOptions options) {
+    if(options.enabled) {
+        renderer->gpu_profiler.summary_interval = GPU_PROFILER_SUMMARY_INTERVAL;
+    }
+}
+
+static void finish_gpu_stats(Renderer *renderer, GpuStatsOptions options) {
+    if(options.path[0]) {
+        gpu_profiler_dump_summary(&renderer->gpu_profiler, options.path);
+    }
+}
+
+// Writes B8G8R8A8 pixels as a binary PPM, which most image tools can compare
+static void write_ppm(const char *path, const u8 *pixels, u32 width, u32 height) {
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+        printf("Could not open %s for writing\n", path);
+        return;
+    }
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    u8 *row = (u8 *)malloc(width * 3);
+    assert(row);
+    for(u32 y = 0; y < height; ++y) {
+        const u8 *texels = &pixels[(u64)y * width * 4];
+        for(u32 x = 0; x < width; ++x) {
+            row[x * 3 + 0] = texels[x * 4 + 2];
+            row[x * 3 + 1] = texels[x * 4 + 1];
+            row[x * 3 + 2] = texels[x * 4 + 0];
+        }
+        fwrite(row, 1, width * 3, file);
+    }
+    free(row);
+    fclose(file);
+}
+
+// Renders a file into offscreen images without a window or display, so frame timings and
+// image comparisons also run on machines with only a CPU Vulkan implementation. The view
+// scrolls down one line every frame so the draw lists change like they do when scrolling.
+static int run_headless(HeadlessOptions options, const char *device_override, GlyphRasterizer glyph_rasterizer,
+    GpuStatsOptions gpu_stats) {
+    Renderer renderer = renderer_initialize_headless(options.width, options.height, device_override,
+        glyph_rasterizer);
+    start_gpu_stats(&renderer, gpu_stats);
+    Editor editor = editor_initialize();
+    editor_open_file(&editor, options.file_path);
+
+    u32 lines_on_screen = renderer_get_number_of_lines_on_screen(&renderer);
+    u64 total_frame_time_ns = 0;
+    u64 max_frame_time_ns = 0;
+    for(u32 i = 0; i < options.num_frames; ++i) {
+        u64 frame_start_ns = platform_get_time_ns();
+
+        DrawList draw_lists[] = {
+            text_document_get_text_draw_list(&editor.active_document, lines_on_screen),
+            text_document_get_line_number_draw_list(&editor.active_document, lines_on_screen)
+        };
+        renderer_update_draw_lists(&renderer, draw_lists, ARRAY_LENGTH(draw_lists));
+        renderer_present(&renderer);
+        for(u32 j = 0; j < ARRAY_LENGTH(draw_lists); ++j) {
+            free(draw_lists[j].commands);
+        }
+
+        u64 frame_time_ns = platform_get_time_ns() - frame_start_ns;
+        total_frame_time_ns += frame_time_ns;
+        max_frame_time_ns = MAX(max_frame_time_ns, frame_time_ns);
+
+        TextDocument *document = &editor.active_document;
+        if(document->view.start_line + lines_on_screen < document->num_lines) {
+            editor_scroll_down(&editor, 1);
+        }
+        else {
+            editor_scroll_down(&editor, -(i32)document->view.start_line);
+        }
+    }
+
+    if(options.num_frames > 0) {
+        printf("%u frames, average %.3f ms, worst %.3f ms\n", options.num_frames,
+            (double)total_frame_time_ns / options.num_frames / 1e6, (double)max_frame_time_ns / 1e6);
+    }
+    gpu_allocator_print_stats(&renderer.allocator);
+    gpu_profiler_write_summary(&renderer.gpu_profiler, stdout);
+    finish_gpu_stats(&renderer, gpu_stats);
+
+    if(options.dump_path[0] && options.num_frames > 0) {
+        u8 *pixels = (u8 *)malloc((u64)options.width * options.height * 4);
+        assert(pixels);
+        renderer_read_back_frame(&renderer, pixels);
+        write_ppm(options.dump_path, pixels, options.width, options.height);
+        free(pixels);
+    }
+
+    editor_destroy(&editor);
+    renderer_destroy(&renderer);
+    return 0;
+}
+
+#define EDITOR_POLL_INTERVAL_NS 1000000
+#define RENDER_THREAD_IDLE_NS 1000000
+
+typedef struct RenderThreadContext {
+    Renderer *renderer;
+    FrameQueue *frame_queue;
+    volatile u32 quit;
+} RenderThreadContext;
+
+// The render thread owns the renderer from the moment it is started until it is joined,
+// the editor thread only talks to it through the frame queue.
+static void render_thread_main(void *data) {
+    RenderThreadContext *context = (RenderThreadContext *)data;
+    Renderer *renderer = context->renderer;
+    trace_set_thread_name("render");
+
+    while(!platform_atomic_load_u32(&context->quit)) {
+        renderer_wait_for_next_frame(renderer);
+
+        FrameSnapshot *snapshot = frame_queue_pop_latest(context->frame_queue);
+        if(!snapshot) {
+            platform_sleep_until_ns(platform_get_time_ns() + RENDER_THREAD_IDLE_NS);
+            continue;
+        }
+
+#ifdef _WIN32
+        u32 lines_on_screen = renderer_get_number_of_lines_on_screen(renderer);
+#endif
+        renderer_update_draw_lists(renderer, snapshot->draw_lists, snapshot->num_draw_lists);
+        renderer_present(renderer);
+        frame_snapshot_destroy(snapshot);
+
+#ifdef _WIN32
+        // Draw lists are only built when painting, the window has to be
+        // repainted once a resize changed the number of visible lines
+        if(renderer_get_number_of_lines_on_screen(renderer) != lines_on_screen) {
+            InvalidateRect(renderer->window.handle, NULL, FALSE);
+        }
+#endif
+    }
+}
+
+// Builds the draw lists of the current editor state and hands them to the render thread
+static void publish_frame(Editor *editor, FrameQueue *frame_queue, u32 lines_on_screen) {
+    TRACE_ZONE_BEGIN(zone, "build_draw_lists");
+    DrawList draw_lists[] = {
+        text_document_get_text_draw_list(&editor->active_document, lines_on_screen),
+        text_document_get_line_number_draw_list(&editor->active_document, lines_on_screen)
+    };
+    frame_queue_push(frame_queue, frame_snapshot_create(draw_lists, ARRAY_LENGTH(draw_lists)));
+    TRACE_ZONE_END(zone);
+}
+
 typedef struct WindowProcContext {
     Editor *editor;
     Renderer *renderer;
+    FrameQueue *frame_queue;
 } WindowProcContext;
 
 #ifdef _WIN32
@@ -25,19 +304,8 @@ LRESULT CALLBACK window_proc(HWND hwnd, UINT msg, WPARAM wparam, LPARAM lparam)
         PAINTSTRUCT paint_struct = { 0 };
         BeginPaint(hwnd, &paint_struct);
 
-        DrawList draw_lists[] = {
-            text_document_get_text_draw_list(
-                &context->editor->active_document,
-                renderer_get_number_of_lines_on_screen(context->renderer)
-            ),
-            text_document_get_line_number_draw_list(
-                &context->editor->active_document,
-                renderer_get_number_of_lines_on_screen(context->renderer)
-            )
-        };
-
-        renderer_update_draw_lists(context->renderer, draw_lists, _countof(draw_lists));
-        renderer_present(context->renderer);
+        publish_frame(context->editor, context->frame_queue,
+            renderer_get_number_of_lines_on_screen(context->renderer));
 
         EndPaint(hwnd, &paint_struct);
     } return 0;
@@ -60,6 +328,30 @@ int WINAPI wWinMain(HINSTANCE hinstance, HINSTANCE prev_hinstance, PWSTR cmd_lin
     freopen_s(&dummy, "CONOUT$", "w", stdout);
     freopen_s(&dummy, "CONOUT$", "w", stderr);
 
+    char arguments[1024];
+    snprintf(arguments, sizeof(arguments), "%ls", cmd_line);
+    HeadlessOptions headless_options = {
+        .width = DEFAULT_HEADLESS_WIDTH,
+        .height = DEFAULT_HEADLESS_HEIGHT,
+        .num_frames = DEFAULT_HEADLESS_FRAMES,
+        .file_path = "C:/Users/RasmusMichelsen/Desktop/Atlas/src/main.c"
+    };
+    headless_options = get_headless_arguments(arguments, headless_options);
+
+    // --device=index|name overrides the automatic device selection
+    char device_override[MAX_DEVICE_OVERRIDE_LENGTH] = { 0 };
+    copy_argument_value(arguments, "--device=", device_override, sizeof(device_override));
+    char trace_path[FILENAME_MAX] = { 0 };
+    copy_argument_value(arguments, "--trace=", trace_path, sizeof(trace_path));
+    GpuStatsOptions gpu_stats = get_gpu_stats_arguments(arguments, (GpuStatsOptions) { 0 });
+    GlyphRasterizer glyph_rasterizer = get_glyph_rasterizer_argument(arguments, GLYPH_RASTERIZER_LINES);
+    start_trace(trace_path);
+    if(headless_options.enabled) {
+        int result = run_headless(headless_options, device_override, glyph_rasterizer, gpu_stats);
+        finish_trace(trace_path);
+        return result;
+    }
+
     const char *window_class_name = "Atlas_Class";
     const char *window_title = "Atlas";
     WNDCLASSEX window_class = {
@@ -93,13 +385,26 @@ int WINAPI wWinMain(HINSTANCE hinstance, HINSTANCE prev_hinstance, PWSTR cmd_lin
     ShowWindow(hwnd, cmd_show);
 
     Editor editor = editor_initialize();
-    Renderer renderer = renderer_initialize((Window) { .handle = hwnd, .instance = hinstance });
+    VkPresentModeKHR present_mode = get_present_mode_argument(arguments, VK_PRESENT_MODE_FIFO_KHR);
+
+    Renderer renderer = renderer_initialize((Window) { .handle = hwnd, .instance = hinstance }, present_mode,
+        device_override, glyph_rasterizer);
+    start_gpu_stats(&renderer, gpu_stats);
+    FrameQueue frame_queue = { 0 };
     WindowProcContext window_proc_context = {
         .editor = &editor,
-        .renderer = &renderer
+        .renderer = &renderer,
+        .frame_queue = &frame_queue
     };
     SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)&window_proc_context);
 
+    RenderThreadContext render_thread_context = {
+        .renderer = &renderer,
+        .frame_queue = &frame_queue,
+        .quit = 0
+    };
+    Thread render_thread = platform_create_thread(render_thread_main, &render_thread_context);
+
     editor_open_file(&editor, "C:/Users/RasmusMichelsen/Desktop/Atlas/src/main.c");
     
     MSG msg;
@@ -110,17 +415,47 @@ int WINAPI wWinMain(HINSTANCE hinstance, HINSTANCE prev_hinstance, PWSTR cmd_lin
         DispatchMessage(&msg);
     }
 
+    platform_atomic_store_u32(&render_thread_context.quit, 1);
+    platform_join_thread(render_thread);
+    frame_queue_destroy(&frame_queue);
+    finish_gpu_stats(&renderer, gpu_stats);
     renderer_destroy(&renderer);
+    finish_trace(trace_path);
     UnregisterClass(window_class_name, hinstance);
     DestroyWindow(hwnd);
     return 0;
 }
 #else
 int main(int argc, char **argv) {
+    HeadlessOptions headless_options = {
+        .width = DEFAULT_HEADLESS_WIDTH,
+        .height = DEFAULT_HEADLESS_HEIGHT,
+        .num_frames = DEFAULT_HEADLESS_FRAMES,
+        .file_path = "/home/rm/Atlas/src/main.c"
+    };
+    // --device=index|name overrides the automatic device selection
+    char device_override[MAX_DEVICE_OVERRIDE_LENGTH] = { 0 };
+    char trace_path[FILENAME_MAX] = { 0 };
+    GpuStatsOptions gpu_stats = { 0 };
+    GlyphRasterizer glyph_rasterizer = GLYPH_RASTERIZER_LINES;
+    for(int i = 1; i < argc; ++i) {
+        headless_options = get_headless_arguments(argv[i], headless_options);
+        copy_argument_value(argv[i], "--device=", device_override, sizeof(device_override));
+        copy_argument_value(argv[i], "--trace=", trace_path, sizeof(trace_path));
+        gpu_stats = get_gpu_stats_arguments(argv[i], gpu_stats);
+        glyph_rasterizer = get_glyph_rasterizer_argument(argv[i], glyph_rasterizer);
+    }
+    start_trace(trace_path);
+    if(headless_options.enabled) {
+        int result = run_headless(headless_options, device_override, glyph_rasterizer, gpu_stats);
+        finish_trace(trace_path);
+        return result;
+    }
+
     xcb_connection_t *connection = xcb_connect(NULL, NULL);
     xcb_screen_t *screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
 
-    uint32_t values[2] = { screen->black_pixel, 0 };
+    uint32_t values[2] = { screen->black_pixel, XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY };
 
     xcb_window_t window = xcb_generate_id(connection);
 
@@ -143,27 +478,56 @@ int main(int argc, char **argv) {
 
     Window w;
 
-    Renderer renderer = renderer_initialize((Window) { .handle = window, .connection = connection });
+    VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    for(int i = 1; i < argc; ++i) {
+        present_mode = get_present_mode_argument(argv[i], present_mode);
+    }
+
+    Renderer renderer = renderer_initialize((Window) { .handle = window, .connection = connection }, present_mode,
+        device_override, glyph_rasterizer);
+    start_gpu_stats(&renderer, gpu_stats);
 
     Editor editor = editor_initialize();
     editor_open_file(&editor, "/home/rm/Atlas/src/main.c");
 
+    FrameQueue frame_queue = { 0 };
+    RenderThreadContext render_thread_context = {
+        .renderer = &renderer,
+        .frame_queue = &frame_queue,
+        .quit = 0
+    };
+    Thread render_thread = platform_create_thread(render_thread_main, &render_thread_context);
+
+    // A frame is only published when something changed, the render thread picks
+    // up the new number of lines itself once it has resized the swapchain
+    bool redraw = true;
+    u32 lines_on_screen = 0;
     for (;;) {
-        DrawList draw_lists[] = {
-            text_document_get_text_draw_list(
-                &editor.active_document,
-                renderer_get_number_of_lines_on_screen(&renderer)
-            ),
-            text_document_get_line_number_draw_list(
-                &editor.active_document,
-                renderer_get_number_of_lines_on_screen(&renderer)
-            )
-        };
+        xcb_generic_event_t *event;
+        while((event = xcb_poll_for_event(connection))) {
+            u8 event_type = event->response_type & ~0x80;
+            if(event_type == XCB_EXPOSE || event_type == XCB_CONFIGURE_NOTIFY) {
+                redraw = true;
+            }
+            free(event);
+        }
 
-        renderer_update_draw_lists(&renderer, draw_lists, ARRAY_LENGTH(draw_lists));
-        renderer_present(&renderer);
+        u32 current_lines_on_screen = renderer_get_number_of_lines_on_screen(&renderer);
+        if(redraw || current_lines_on_screen != lines_on_screen) {
+            publish_frame(&editor, &frame_queue, current_lines_on_screen);
+            lines_on_screen = current_lines_on_screen;
+            redraw = false;
+        }
+
+        platform_sleep_until_ns(platform_get_time_ns() + EDITOR_POLL_INTERVAL_NS);
     }
 
+    platform_atomic_store_u32(&render_thread_context.quit, 1);
+    platform_join_thread(render_thread);
+    frame_queue_destroy(&frame_queue);
+    finish_gpu_stats(&renderer, gpu_stats);
+    renderer_destroy(&renderer);
+    finish_trace(trace_path);
     xcb_destroy_window(connection, window);
     return 0;
 }
@@ -0,0 +1,210 @@
+#include "platform.h"
+
+typedef struct ThreadStart {
+	ThreadProc proc;
+	void *data;
+} ThreadStart;
+
+#ifdef _WIN32
+// Not defined by older SDKs, supported since Windows 10 1803
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static u64 platform_get_time_ns(void) {
+	static LARGE_INTEGER frequency;
+	if(frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	u64 seconds = (u64)counter.QuadPart / (u64)frequency.QuadPart;
+	u64 remainder = (u64)counter.QuadPart % (u64)frequency.QuadPart;
+	return seconds * NANOSECONDS_PER_SECOND + remainder * NANOSECONDS_PER_SECOND / (u64)frequency.QuadPart;
+}
+
+static void platform_sleep_until_ns(u64 deadline_ns) {
+	// Sleep() is limited to the scheduler tick, a high resolution timer is
+	// accurate enough to wake up right before a vertical blank
+	static HANDLE timer;
+	if(!timer) {
+		timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		if(!timer) {
+			timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+		}
+		assert(timer);
+	}
+
+	u64 now = platform_get_time_ns();
+	if(deadline_ns <= now) {
+		return;
+	}
+
+	// Negative due times are relative, in units of 100ns
+	LARGE_INTEGER due_time = { .QuadPart = -(LONGLONG)((deadline_ns - now) / 100) };
+	if(SetWaitableTimer(timer, &due_time, 0, NULL, NULL, FALSE)) {
+		WaitForSingleObject(timer, INFINITE);
+	}
+}
+
+static DWORD WINAPI thread_start(LPVOID parameter) {
+	ThreadStart start = *(ThreadStart *)parameter;
+	free(parameter);
+	start.proc(start.data);
+	return 0;
+}
+
+static Thread platform_create_thread(ThreadProc proc, void *data) {
+	ThreadStart *start = (ThreadStart *)malloc(sizeof(ThreadStart));
+	assert(start);
+	*start = (ThreadStart) { .proc = proc, .data = data };
+
+	HANDLE handle = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+	assert(handle);
+	return (Thread) { .handle = handle };
+}
+
+static void platform_join_thread(Thread thread) {
+	WaitForSingleObject(thread.handle, INFINITE);
+	CloseHandle(thread.handle);
+}
+
+static u32 platform_get_processor_count(void) {
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	return MAX((u32)system_info.dwNumberOfProcessors, 1);
+}
+
+// Interlocked operations are full barriers
+static u32 platform_atomic_load_u32(volatile u32 *value) {
+	return (u32)InterlockedCompareExchange((volatile LONG *)value, 0, 0);
+}
+
+static void platform_atomic_store_u32(volatile u32 *value, u32 new_value) {
+	InterlockedExchange((volatile LONG *)value, (LONG)new_value);
+}
+
+static u32 platform_atomic_add_u32(volatile u32 *value, u32 addend) {
+	return (u32)InterlockedExchangeAdd((volatile LONG *)value, (LONG)addend);
+}
+
+static void *platform_atomic_load_pointer(void *volatile *pointer) {
+	return InterlockedCompareExchangePointer(pointer, NULL, NULL);
+}
+
+static void *platform_atomic_exchange_pointer(void *volatile *pointer, void *new_pointer) {
+	return InterlockedExchangePointer(pointer, new_pointer);
+}
+
+static bool platform_get_cache_directory(char *path, u64 path_size) {
+	char local_app_data[MAX_PATH];
+	DWORD length = GetEnvironmentVariableA("LOCALAPPDATA", local_app_data, sizeof(local_app_data));
+	if(length == 0 || length >= sizeof(local_app_data)) {
+		return false;
+	}
+
+	int written = snprintf(path, path_size, "%s\\Atlas", local_app_data);
+	if(written < 0 || (u64)written >= path_size) {
+		return false;
+	}
+	return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+static bool platform_replace_file(const char *source_path, const char *destination_path) {
+	return MoveFileExA(source_path, destination_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+#else
+static u64 platform_get_time_ns(void) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (u64)time.tv_sec * NANOSECONDS_PER_SECOND + (u64)time.tv_nsec;
+}
+
+static void platform_sleep_until_ns(u64 deadline_ns) {
+	struct timespec deadline = {
+		.tv_sec = (time_t)(deadline_ns / NANOSECONDS_PER_SECOND),
+		.tv_nsec = (long)(deadline_ns % NANOSECONDS_PER_SECOND)
+	};
+
+	// Absolute deadlines do not drift when the sleep is interrupted by a signal
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+	}
+}
+
+static void *thread_start(void *parameter) {
+	ThreadStart start = *(ThreadStart *)parameter;
+	free(parameter);
+	start.proc(start.data);
+	return NULL;
+}
+
+static Thread platform_create_thread(ThreadProc proc, void *data) {
+	ThreadStart *start = (ThreadStart *)malloc(sizeof(ThreadStart));
+	assert(start);
+	*start = (ThreadStart) { .proc = proc, .data = data };
+
+	pthread_t handle;
+	int result = pthread_create(&handle, NULL, thread_start, start);
+	assert(result == 0);
+	return (Thread) { .handle = handle };
+}
+
+static void platform_join_thread(Thread thread) {
+	pthread_join(thread.handle, NULL);
+}
+
+static u32 platform_get_processor_count(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (u32)count : 1;
+}
+
+static u32 platform_atomic_load_u32(volatile u32 *value) {
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void platform_atomic_store_u32(volatile u32 *value, u32 new_value) {
+	__atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+static u32 platform_atomic_add_u32(volatile u32 *value, u32 addend) {
+	return __atomic_fetch_add(value, addend, __ATOMIC_ACQ_REL);
+}
+
+static void *platform_atomic_load_pointer(void *volatile *pointer) {
+	return __atomic_load_n(pointer, __ATOMIC_ACQUIRE);
+}
+
+static void *platform_atomic_exchange_pointer(void *volatile *pointer, void *new_pointer) {
+	return __atomic_exchange_n(pointer, new_pointer, __ATOMIC_ACQ_REL);
+}
+
+static bool platform_get_cache_directory(char *path, u64 path_size) {
+	const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+	int written;
+	if(xdg_cache_home && xdg_cache_home[0] == '/') {
+		written = snprintf(path, path_size, "%s", xdg_cache_home);
+	}
+	else {
+		const char *home = getenv("HOME");
+		if(!home || !home[0]) {
+			return false;
+		}
+		written = snprintf(path, path_size, "%s/.cache", home);
+	}
+	if(written < 0 || (u64)written + sizeof("/atlas") > path_size) {
+		return false;
+	}
+
+	// The base directory is not guaranteed to exist on a fresh home directory
+	if(mkdir(path, 0700) != 0 && errno != EEXIST) {
+		return false;
+	}
+	strcat(path, "/atlas");
+	return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+static bool platform_replace_file(const char *source_path, const char *destination_path) {
+	return rename(source_path, destination_path) == 0;
+}
+#endif
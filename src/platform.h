@@ -0,0 +1,42 @@
+#pragma once
+
+#define NANOSECONDS_PER_SECOND 1000000000ull
+
+// Monotonic clock in nanoseconds, only meaningful relative to other readings
+static u64 platform_get_time_ns(void);
+
+// Blocks the calling thread without spinning until the clock reaches the deadline
+static void platform_sleep_until_ns(u64 deadline_ns);
+
+#ifdef _WIN32
+typedef struct Thread {
+	HANDLE handle;
+} Thread;
+#else
+typedef struct Thread {
+	pthread_t handle;
+} Thread;
+#endif
+
+typedef void (*ThreadProc)(void *data);
+
+static Thread platform_create_thread(ThreadProc proc, void *data);
+static void platform_join_thread(Thread thread);
+// Logical processors available to the process, at least 1
+static u32 platform_get_processor_count(void);
+
+// Loads acquire and stores release, enough to hand data from one thread to another
+static u32 platform_atomic_load_u32(volatile u32 *value);
+static void platform_atomic_store_u32(volatile u32 *value, u32 new_value);
+// Returns the value before the addition
+static u32 platform_atomic_add_u32(volatile u32 *value, u32 addend);
+static void *platform_atomic_load_pointer(void *volatile *pointer);
+// Returns the pointer that was replaced
+static void *platform_atomic_exchange_pointer(void *volatile *pointer, void *new_pointer);
+
+// Per-user directory for data that can be regenerated, e.g. %LOCALAPPDATA%\Atlas or ~/.cache/atlas.
+// The directory is created if it does not exist yet, returns false if it cannot be determined.
+static bool platform_get_cache_directory(char *path, u64 path_size);
+
+// Replaces the destination with the source file in one step, so a crash never leaves a partial file behind
+static bool platform_replace_file(const char *source_path, const char *destination_path);
@@ -1,20 +1,68 @@
 #include "renderer.h"
 
+// Generated by the build from src/shaders
+#include "fragment.frag.h"
+#include "vertex.vert.h"
+#include "write_texture_atlas.comp.h"
+#include "write_texture_atlas_curves.comp.h"
+
 #define GLYPH_ATLAS_SIZE 2048
 #define MAX_TOTAL_GLYPH_LINES 65536
 #define NUM_PRINTABLE_CHARS 95
-
-#define VK_CHECK(x) if((x) != VK_SUCCESS) { 			\
-	assert(false); 										\
-	printf("Vulkan error: %s:%i", __FILE__, __LINE__); 	\
-}
+#define FIRST_PRINTABLE_CHAR 0x20
+#define GLYPHS_PER_TESSELLATION_BATCH 16
+#define MAX_TESSELLATION_THREADS 16
+#define INITIAL_TESSELLATION_LINES 4096
+// Largest distance between a curve and the lines it is flattened into, in outline units
+// (pixels vertically, subpixels horizontally)
+#define FLATTENING_TOLERANCE 0.05f
+#define MAX_SEGMENTS_PER_CURVE 64
+#define RADIX_SORT_DIGIT_BITS 8
+#define RADIX_SORT_BUCKETS (1 << RADIX_SORT_DIGIT_BITS)
+#define VERTEX_RING_SHRINK_CHECK_FRAMES 600
+#define DEFAULT_REFRESH_PERIOD_NS (NANOSECONDS_PER_SECOND / 60)
+#define FRAME_PACER_SLACK_NS 1000000
+#define MAX_SUBMIT_WAITS 4
 
 typedef struct TessellationContext {
+	GlyphRasterizer rasterizer;
 	GlyphLine *lines;
+	// With GLYPH_RASTERIZER_CURVES the control point of every line, which makes it a curve
+	GlyphPoint *controls;
 	u32 num_lines;
+	u32 capacity;
+	float flattening_tolerance;
 	GlyphPoint last_point;
+	// Scratch space of sort_glyph_lines, sort_keys holds two arrays of sort_capacity keys
+	u64 *sort_keys;
+	GlyphLine *sort_lines;
+	GlyphPoint *sort_controls;
+	u32 sort_capacity;
 } TessellationContext;
 
+// Glyphs are handed out to the workers in batches through next_batch. Every worker tessellates
+// into its own line buffer with its own FT_Face, the faces share the font file in memory.
+typedef struct TessellationJob {
+	const FT_Byte *font_data;
+	FT_Long font_data_size;
+	u32 font_size;
+	float flattening_tolerance;
+	GlyphRasterizer rasterizer;
+	u32 first_codepoint;
+	u32 num_glyphs;
+	volatile u32 next_batch;
+	// Until the buffers are merged the offsets are relative to the buffer of glyph_workers[i]
+	GlyphOffset *glyph_offsets;
+	u8 *glyph_workers;
+} TessellationJob;
+
+typedef struct TessellationWorker {
+	TessellationJob *job;
+	u32 index;
+	Thread thread;
+	TessellationContext context;
+} TessellationWorker;
+
 typedef struct GraphicsPushConstants {
 	float display_size[2];
 	float glyph_width;
@@ -22,23 +70,29 @@ typedef struct GraphicsPushConstants {
 	u32 cell_width;
 	u32 cell_height;
 	u32 glyph_atlas_size;
+	u32 first_line;
 } GraphicsPushConstants;
 
-typedef struct Vertex {
-	u64 pos : 3;
-	u64 uv : 3;
-	u64 glyph_offset_x : 13;
-	u64 glyph_offset_y : 13;
-	u64 cell_offset_x : 16;
-	u64 cell_offset_y : 16;
-} Vertex;
-
 typedef enum ShaderType {
 	SHADER_TYPE_COMPUTE,
 	SHADER_TYPE_VERTEX,
 	SHADER_TYPE_FRAGMENT
 } ShaderType;
 
+typedef struct EmbeddedShader {
+	const char *name;
+	const u32 *code;
+	u64 size;
+} EmbeddedShader;
+
+static const EmbeddedShader EMBEDDED_SHADERS[] = {
+	{ "fragment.frag", fragment_frag_spirv, sizeof(fragment_frag_spirv) },
+	{ "vertex.vert", vertex_vert_spirv, sizeof(vertex_vert_spirv) },
+	{ "write_texture_atlas.comp", write_texture_atlas_comp_spirv, sizeof(write_texture_atlas_comp_spirv) },
+	{ "write_texture_atlas_curves.comp", write_texture_atlas_curves_comp_spirv,
+		sizeof(write_texture_atlas_curves_comp_spirv) }
+};
+
 const char *LAYERS[] = { "VK_LAYER_KHRONOS_validation" };
 const char *INSTANCE_EXTENSIONS[] = {
 	VK_KHR_SURFACE_EXTENSION_NAME,
@@ -49,6 +103,11 @@ const char *INSTANCE_EXTENSIONS[] = {
 #endif
 	VK_EXT_DEBUG_UTILS_EXTENSION_NAME
 };
+// Without a surface the window system extensions are not required, CPU implementations
+// such as lavapipe on machines without a display may not expose them at all
+const char *HEADLESS_INSTANCE_EXTENSIONS[] = {
+	VK_EXT_DEBUG_UTILS_EXTENSION_NAME
+};
 const char *DEVICE_EXTENSIONS[] = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
@@ -82,7 +141,7 @@ static VkDebugUtilsMessengerEXT create_debug_messenger(VkInstance instance) {
 }
 #endif
 
-static VkInstance create_instance() {
+static VkInstance create_instance(bool headless) {
 	VkInstanceCreateInfo instance_info = {
 		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
 		.pNext = &(VkValidationFeaturesEXT) {
@@ -94,14 +153,14 @@ static VkInstance create_instance() {
 		},
 		.pApplicationInfo = &(VkApplicationInfo) {
 			.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-			.apiVersion = VK_API_VERSION_1_1
+			.apiVersion = VK_API_VERSION_1_2
 		},
 #ifndef NDEBUG
 		.enabledLayerCount = ARRAY_LENGTH(LAYERS),
 		.ppEnabledLayerNames = LAYERS,
 #endif
-		.enabledExtensionCount = ARRAY_LENGTH(INSTANCE_EXTENSIONS),
-		.ppEnabledExtensionNames = INSTANCE_EXTENSIONS
+		.enabledExtensionCount = headless ? ARRAY_LENGTH(HEADLESS_INSTANCE_EXTENSIONS) : ARRAY_LENGTH(INSTANCE_EXTENSIONS),
+		.ppEnabledExtensionNames = headless ? HEADLESS_INSTANCE_EXTENSIONS : INSTANCE_EXTENSIONS
 	};
 
 	VkInstance instance;
@@ -129,7 +188,151 @@ static VkSurfaceKHR create_surface(VkInstance instance, Window window) {
 	return surface;
 }
 
-static PhysicalDevice create_physical_device(VkInstance instance, VkSurfaceKHR surface) {
+typedef struct QueueFamilies {
+	u32 graphics_family_idx;
+	u32 compute_family_idx;
+} QueueFamilies;
+
+// Rendering uses the first graphics family that can present. Compute prefers a family
+// without graphics support, it maps to a separate hardware queue that runs alongside
+// rendering, and falls back to the graphics family.
+static QueueFamilies find_queue_families(VkPhysicalDevice physical_device, VkSurfaceKHR surface) {
+	u32 queue_family_count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
+
+	VkQueueFamilyProperties *queue_families = (VkQueueFamilyProperties *)malloc(queue_family_count * sizeof(VkQueueFamilyProperties));
+	assert(queue_families);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families);
+
+	QueueFamilies families = {
+		.graphics_family_idx = UINT32_MAX,
+		.compute_family_idx = UINT32_MAX
+	};
+	for(u32 i = 0; i < queue_family_count; ++i) {
+		VkQueueFlags flags = queue_families[i].queueFlags;
+		if(queue_families[i].queueCount == 0) {
+			continue;
+		}
+
+		if((flags & VK_QUEUE_GRAPHICS_BIT) && families.graphics_family_idx == UINT32_MAX) {
+			VkBool32 supports_present = VK_TRUE;
+			if(surface != VK_NULL_HANDLE) {
+				VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, i, surface, &supports_present));
+			}
+			if(supports_present) {
+				families.graphics_family_idx = i;
+			}
+		}
+		if((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT) &&
+			families.compute_family_idx == UINT32_MAX) {
+			families.compute_family_idx = i;
+		}
+	}
+	if(families.compute_family_idx == UINT32_MAX) {
+		families.compute_family_idx = families.graphics_family_idx;
+	}
+
+	free(queue_families);
+	return families;
+}
+
+static bool supports_device_extension(VkPhysicalDevice physical_device, const char *extension_name) {
+	u32 extension_count = 0;
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, NULL));
+
+	VkExtensionProperties *extensions = (VkExtensionProperties *)malloc(extension_count * sizeof(VkExtensionProperties));
+	assert(extensions);
+	VK_CHECK(vkEnumerateDeviceExtensionProperties(physical_device, NULL, &extension_count, extensions));
+
+	bool supported = false;
+	for(u32 i = 0; i < extension_count; ++i) {
+		if(strcmp(extensions[i].extensionName, extension_name) == 0) {
+			supported = true;
+			break;
+		}
+	}
+	free(extensions);
+	return supported;
+}
+
+// Everything create_logical_device enables has to be supported
+static bool supports_required_features(VkPhysicalDevice physical_device, VkSurfaceKHR surface) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	if(properties.apiVersion < VK_API_VERSION_1_2) {
+		return false;
+	}
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures timeline_semaphore_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES
+	};
+	VkPhysicalDeviceFeatures2 features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &timeline_semaphore_features
+	};
+	vkGetPhysicalDeviceFeatures2(physical_device, &features);
+	if(!features.features.shaderStorageImageWriteWithoutFormat || !features.features.shaderFloat64 ||
+		!features.features.shaderInt64 || !timeline_semaphore_features.timelineSemaphore) {
+		return false;
+	}
+
+	return surface == VK_NULL_HANDLE || supports_device_extension(physical_device, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+}
+
+// Zero for devices the renderer cannot run on. The device type dominates the score, so an
+// integrated GPU is only chosen over a discrete one if the discrete one is unusable. Within
+// a type, a dedicated compute family and more device-local memory break the tie.
+static u64 score_physical_device(VkPhysicalDevice physical_device, VkSurfaceKHR surface) {
+	if(!supports_required_features(physical_device, surface)) {
+		return 0;
+	}
+
+	QueueFamilies families = find_queue_families(physical_device, surface);
+	if(families.graphics_family_idx == UINT32_MAX) {
+		return 0;
+	}
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physical_device, &properties);
+	u64 score = 1;
+	switch(properties.deviceType) {
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+		score += 40000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+		score += 30000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+		score += 20000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU:
+		score += 10000;
+		break;
+	default:
+		break;
+	}
+
+	if(families.compute_family_idx != families.graphics_family_idx) {
+		score += 1000;
+	}
+
+	// One point per 64 MiB of device-local memory, capped well below the type weights
+	VkPhysicalDeviceMemoryProperties memory_properties;
+	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+	u64 device_local_size = 0;
+	for(u32 i = 0; i < memory_properties.memoryHeapCount; ++i) {
+		if(memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+			device_local_size += memory_properties.memoryHeaps[i].size;
+		}
+	}
+	score += MIN(device_local_size >> 26, 4096);
+
+	return score;
+}
+
+// Picks the highest scoring device unless device_override names a usable one, either by its
+// index or by a part of its name. The surface is VK_NULL_HANDLE when rendering headless.
+static PhysicalDevice create_physical_device(VkInstance instance, VkSurfaceKHR surface, const char *device_override) {
 	u32 device_count = 0;
 	vkEnumeratePhysicalDevices(instance, &device_count, NULL);
 	assert(device_count > 0 && "No Vulkan 1.2 capable devices found");
@@ -137,69 +340,100 @@ static PhysicalDevice create_physical_device(VkInstance instance, VkSurfaceKHR s
 	VkPhysicalDevice *physical_devices = (VkPhysicalDevice *)malloc(device_count * sizeof(VkPhysicalDevice));
 	VK_CHECK(vkEnumeratePhysicalDevices(instance, &device_count, physical_devices));
 
-	// Find the first discrete GPU
-	VkPhysicalDeviceProperties properties;
 	VkPhysicalDevice physical_device = VK_NULL_HANDLE;
+	VkPhysicalDevice override_device = VK_NULL_HANDLE;
+	u64 best_score = 0;
 	for(u32 i = 0; i < device_count; ++i) {
+		VkPhysicalDeviceProperties properties;
 		vkGetPhysicalDeviceProperties(physical_devices[i], &properties);
-		if(properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-			continue;
+		u64 score = score_physical_device(physical_devices[i], surface);
+
+		if(device_override && device_override[0]) {
+			char *index_end;
+			unsigned long index = strtoul(device_override, &index_end, 10);
+			bool matches = *index_end == '\0' ? index == i : strstr(properties.deviceName, device_override) != NULL;
+			if(matches && override_device == VK_NULL_HANDLE) {
+				if(score > 0) {
+					override_device = physical_devices[i];
+				}
+				else {
+					printf("Device %s lacks required features, ignoring override\n", properties.deviceName);
+				}
+			}
 		}
-		physical_device = physical_devices[i];
-		break;
+
+		if(score > best_score) {
+			best_score = score;
+			physical_device = physical_devices[i];
+		}
+	}
+	if(device_override && device_override[0] && override_device == VK_NULL_HANDLE) {
+		printf("No usable device matches %s\n", device_override);
 	}
-	assert(physical_device != VK_NULL_HANDLE);
+	if(override_device != VK_NULL_HANDLE) {
+		physical_device = override_device;
+	}
+	assert(physical_device != VK_NULL_HANDLE && "No device supports the required features");
 	free(physical_devices);
 
-
 	VkPhysicalDeviceProperties2 device_properties = {
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
 	};
 
-	VkSurfaceCapabilitiesKHR surface_capabilities;
+	VkSurfaceCapabilitiesKHR surface_capabilities = { 0 };
 	vkGetPhysicalDeviceProperties2(physical_device, &device_properties);
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_capabilities);
+	if(surface != VK_NULL_HANDLE) {
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, surface, &surface_capabilities);
+	}
+	printf("Using %s\n", device_properties.properties.deviceName);
 
 	VkPhysicalDeviceMemoryProperties memory_properties;
 	vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
 
-	u32 queue_family_count = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, NULL);
-	assert(queue_family_count > 0);
-
-	VkQueueFamilyProperties *queue_families = (VkQueueFamilyProperties *)malloc(queue_family_count * sizeof(VkQueueFamilyProperties));
-	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_families);
-
-	u32 graphics_family_idx = UINT32_MAX;
-	u32 compute_family_idx = UINT32_MAX;
-	for(u32 i = 0; i < queue_family_count; ++i) {
-		if(queue_families[i].queueCount == 0) {
-			continue;
-		}
-
-		if(queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-			graphics_family_idx = i;
-		}
-		if(queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) {
-			compute_family_idx = i;
+	QueueFamilies families = find_queue_families(physical_device, surface);
+
+	u32 num_queue_families = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &num_queue_families, NULL);
+	VkQueueFamilyProperties *queue_families = (VkQueueFamilyProperties *)malloc(
+		num_queue_families * sizeof(VkQueueFamilyProperties));
+	assert(queue_families);
+	vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &num_queue_families, queue_families);
+	u32 graphics_timestamp_valid_bits = queue_families[families.graphics_family_idx].timestampValidBits;
+	u32 compute_timestamp_valid_bits = queue_families[families.compute_family_idx].timestampValidBits;
+	free(queue_families);
+
+	VkPhysicalDeviceFeatures features;
+	vkGetPhysicalDeviceFeatures(physical_device, &features);
+
+	// Integrated and CPU devices read host-visible memory at full speed,
+	// there is nothing to gain from copying into a separate device-local buffer
+	bool has_unified_memory = false;
+	VkPhysicalDeviceType device_type = device_properties.properties.deviceType;
+	if(device_type == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU || device_type == VK_PHYSICAL_DEVICE_TYPE_CPU) {
+		VkMemoryPropertyFlags unified_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		for(u32 i = 0; i < memory_properties.memoryTypeCount; ++i) {
+			if((memory_properties.memoryTypes[i].propertyFlags & unified_flags) == unified_flags) {
+				has_unified_memory = true;
+			}
 		}
 	}
 
-	VkBool32 supports_present = VK_FALSE;
-	VK_CHECK(vkGetPhysicalDeviceSurfaceSupportKHR(physical_device, graphics_family_idx, surface, &supports_present));
-	assert(supports_present);
-
 	return (PhysicalDevice) {
 		.handle = physical_device,
 		.properties = device_properties,
 		.memory_properties = memory_properties,
 		.surface_capabilities = surface_capabilities,
-		.graphics_family_idx = graphics_family_idx,
-		.compute_family_idx = compute_family_idx
+		.graphics_family_idx = families.graphics_family_idx,
+		.compute_family_idx = families.compute_family_idx,
+		.has_unified_memory = has_unified_memory,
+		.graphics_timestamp_valid_bits = graphics_timestamp_valid_bits,
+		.compute_timestamp_valid_bits = compute_timestamp_valid_bits,
+		.has_pipeline_statistics = features.pipelineStatisticsQuery
 	};
 }
 
-static LogicalDevice create_logical_device(PhysicalDevice physical_device) {
+static LogicalDevice create_logical_device(PhysicalDevice physical_device, bool headless) {
 	VkDeviceQueueCreateInfo device_queue_infos[] = {
 		{
 			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
@@ -217,7 +451,10 @@ static LogicalDevice create_logical_device(PhysicalDevice physical_device) {
 
 	VkDeviceCreateInfo device_info = {
 		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.pNext = NULL,
+		.pNext = &(VkPhysicalDeviceTimelineSemaphoreFeatures) {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+			.timelineSemaphore = VK_TRUE
+		},
 		.queueCreateInfoCount =
 			physical_device.graphics_family_idx == physical_device.compute_family_idx ?
 			1 : ARRAY_LENGTH(device_queue_infos),
@@ -226,12 +463,13 @@ static LogicalDevice create_logical_device(PhysicalDevice physical_device) {
 		.enabledLayerCount = ARRAY_LENGTH(LAYERS),
 		.ppEnabledLayerNames = LAYERS,
 #endif
-		.enabledExtensionCount = ARRAY_LENGTH(DEVICE_EXTENSIONS),
+		.enabledExtensionCount = headless ? 0 : ARRAY_LENGTH(DEVICE_EXTENSIONS),
 		.ppEnabledExtensionNames = DEVICE_EXTENSIONS,
 		.pEnabledFeatures = &(VkPhysicalDeviceFeatures) {
 			.shaderStorageImageWriteWithoutFormat = VK_TRUE,
 			.shaderFloat64 = VK_TRUE,
-			.shaderInt64 = VK_TRUE
+			.shaderInt64 = VK_TRUE,
+			.pipelineStatisticsQuery = physical_device.has_pipeline_statistics
 		}
 	};
 
@@ -249,22 +487,146 @@ static LogicalDevice create_logical_device(PhysicalDevice physical_device) {
 	};
 }
 
-static VkCommandPool create_command_pool(PhysicalDevice physical_device, LogicalDevice logical_device) {
+static VkCommandPool create_command_pool(LogicalDevice logical_device, u32 queue_family_idx) {
 	VkCommandPoolCreateInfo command_pool_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
 		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT |
 					VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
-		.queueFamilyIndex = physical_device.graphics_family_idx
+		.queueFamilyIndex = queue_family_idx
 	};
 	VkCommandPool command_pool;
 	VK_CHECK(vkCreateCommandPool(logical_device.handle, &command_pool_info, NULL, &command_pool));
 	return command_pool;
 }
 
-static Swapchain create_swapchain(Window window, VkSurfaceKHR surface, PhysicalDevice physical_device,
-	LogicalDevice logical_device, Swapchain *old_swapchain) {
-	VK_CHECK(vkDeviceWaitIdle(logical_device.handle));
+static QueueTimeline create_queue_timeline(VkDevice device, VkQueue queue) {
+	VkSemaphoreCreateInfo semaphore_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &(VkSemaphoreTypeCreateInfo) {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+			.initialValue = 0
+		}
+	};
+	VkSemaphore semaphore;
+	VK_CHECK(vkCreateSemaphore(device, &semaphore_info, NULL, &semaphore));
+
+	return (QueueTimeline) {
+		.device = device,
+		.queue = queue,
+		.semaphore = semaphore,
+		.submitted_value = 0,
+		.completed_value = 0
+	};
+}
+
+// A wait on a binary semaphore ignores the value
+typedef struct SubmitWait {
+	VkSemaphore semaphore;
+	u64 value;
+	VkPipelineStageFlags stage;
+} SubmitWait;
+
+// Submits work that signals the next value of the timeline, and optionally a binary
+// semaphore for presentation. Returns the value that marks the work as completed.
+static u64 queue_timeline_submit(QueueTimeline *timeline, const VkCommandBuffer *command_buffers,
+	u32 num_command_buffers, const SubmitWait *waits, u32 num_waits, VkSemaphore binary_signal_semaphore) {
+	assert(num_waits <= MAX_SUBMIT_WAITS);
+	VkSemaphore wait_semaphores[MAX_SUBMIT_WAITS];
+	u64 wait_values[MAX_SUBMIT_WAITS];
+	VkPipelineStageFlags wait_stages[MAX_SUBMIT_WAITS];
+	for(u32 i = 0; i < num_waits; ++i) {
+		wait_semaphores[i] = waits[i].semaphore;
+		wait_values[i] = waits[i].value;
+		wait_stages[i] = waits[i].stage;
+	}
+
+	u64 signal_value = timeline->submitted_value + 1;
+	VkSemaphore signal_semaphores[] = { timeline->semaphore, binary_signal_semaphore };
+	u64 signal_values[] = { signal_value, 0 };
+	u32 num_signals = binary_signal_semaphore != VK_NULL_HANDLE ? 2 : 1;
+
+	VkTimelineSemaphoreSubmitInfo timeline_submit_info = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+		.waitSemaphoreValueCount = num_waits,
+		.pWaitSemaphoreValues = wait_values,
+		.signalSemaphoreValueCount = num_signals,
+		.pSignalSemaphoreValues = signal_values
+	};
+	VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = &timeline_submit_info,
+		.waitSemaphoreCount = num_waits,
+		.pWaitSemaphores = wait_semaphores,
+		.pWaitDstStageMask = wait_stages,
+		.commandBufferCount = num_command_buffers,
+		.pCommandBuffers = command_buffers,
+		.signalSemaphoreCount = num_signals,
+		.pSignalSemaphores = signal_semaphores
+	};
+	VK_CHECK(vkQueueSubmit(timeline->queue, 1, &submit_info, VK_NULL_HANDLE));
+
+	timeline->submitted_value = signal_value;
+	return signal_value;
+}
+
+// Returns the latest value the GPU has reached without blocking
+static u64 queue_timeline_poll(QueueTimeline *timeline) {
+	u64 value;
+	VK_CHECK(vkGetSemaphoreCounterValue(timeline->device, timeline->semaphore, &value));
+	timeline->completed_value = MAX(timeline->completed_value, value);
+	return timeline->completed_value;
+}
+
+static void queue_timeline_wait(QueueTimeline *timeline, u64 value) {
+	assert(value <= timeline->submitted_value);
+	if(value <= timeline->completed_value) {
+		return;
+	}
+
+	VkSemaphoreWaitInfo wait_info = {
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.semaphoreCount = 1,
+		.pSemaphores = &timeline->semaphore,
+		.pValues = &value
+	};
+	VK_CHECK(vkWaitSemaphores(timeline->device, &wait_info, UINT64_MAX));
+	timeline->completed_value = value;
+}
+
+static void retire_resource(RetiredResources *retired, RetiredResource resource) {
+	if(retired->count == retired->capacity) {
+		retired->capacity = MAX(retired->capacity * 2, 16);
+		retired->resources = realloc(retired->resources, retired->capacity * sizeof(RetiredResource));
+		assert(retired->resources);
+	}
+	retired->resources[retired->count++] = resource;
+}
 
+static VkPresentModeKHR choose_present_mode(PhysicalDevice physical_device, VkSurfaceKHR surface,
+	VkPresentModeKHR preferred_present_mode) {
+	u32 present_mode_count = 0;
+	VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device.handle, surface, &present_mode_count, NULL));
+
+	VkPresentModeKHR *present_modes = (VkPresentModeKHR *)malloc(present_mode_count * sizeof(VkPresentModeKHR));
+	assert(present_modes);
+	VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(physical_device.handle, surface, &present_mode_count, present_modes));
+
+	// FIFO is the only present mode every implementation has to support
+	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	for(u32 i = 0; i < present_mode_count; ++i) {
+		if(present_modes[i] == preferred_present_mode) {
+			present_mode = preferred_present_mode;
+			break;
+		}
+	}
+
+	free(present_modes);
+	return present_mode;
+}
+
+static Swapchain create_swapchain(Window window, VkSurfaceKHR surface, PhysicalDevice physical_device,
+	LogicalDevice logical_device, VkPresentModeKHR preferred_present_mode, Swapchain *old_swapchain) {
 #ifdef _WIN32
 	RECT client_rect;
 	GetClientRect(window.handle, &client_rect);
@@ -282,6 +644,7 @@ static Swapchain create_swapchain(Window window, VkSurfaceKHR surface, PhysicalD
 		.width = (u32)geometry->width,
 		.height = (u32)geometry->height
 	};
+	free(geometry);
 #endif
 
 	u32 desired_image_count = physical_device.surface_capabilities.minImageCount + 1;
@@ -302,7 +665,7 @@ static Swapchain create_swapchain(Window window, VkSurfaceKHR surface, PhysicalD
 		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
 		.preTransform = physical_device.surface_capabilities.currentTransform,
 		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-		.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR,
+		.presentMode = choose_present_mode(physical_device, surface, preferred_present_mode),
 		.clipped = VK_TRUE,
 		.oldSwapchain = old_swapchain ? old_swapchain->handle : VK_NULL_HANDLE
 	};
@@ -310,17 +673,6 @@ static Swapchain create_swapchain(Window window, VkSurfaceKHR surface, PhysicalD
 	VkSwapchainKHR swapchain;
 	VK_CHECK(vkCreateSwapchainKHR(logical_device.handle, &swapchain_info, NULL, &swapchain));
 
-	// Delete old swapchain
-	if(old_swapchain) {
-		for(int i = 0; i < old_swapchain->image_count; ++i) {
-			vkDestroyImageView(logical_device.handle, old_swapchain->image_views[i], NULL);
-		}
-
-		vkDestroySwapchainKHR(logical_device.handle, old_swapchain->handle, NULL);
-		free(old_swapchain->images);
-		free(old_swapchain->image_views);
-	}
-
 	u32 image_count = 0;
 	VK_CHECK(vkGetSwapchainImagesKHR(logical_device.handle, swapchain, &image_count, NULL));
 
@@ -358,18 +710,185 @@ static Swapchain create_swapchain(Window window, VkSurfaceKHR surface, PhysicalD
 		.present_mode = swapchain_info.presentMode,
 		.extent = extent,
 		.images = images,
-		.image_views = image_views
+		.image_views = image_views,
+		.framebuffers = NULL,
+		.command_buffers = NULL,
+		.recorded_generations = NULL,
+		.image_timeline_values = NULL,
+		.image_allocations = NULL,
+		.readback_buffers = NULL
+	};
+}
+
+static void destroy_swapchain(VkDevice device, GpuAllocator *allocator, VkCommandPool command_pool,
+	Swapchain *swapchain) {
+	if(!swapchain->images) {
+		return;
+	}
+
+	for(u32 i = 0; i < swapchain->image_count; ++i) {
+		if(swapchain->framebuffers) {
+			vkDestroyFramebuffer(device, swapchain->framebuffers[i], NULL);
+		}
+		vkDestroyImageView(device, swapchain->image_views[i], NULL);
+		if(swapchain->image_allocations) {
+			vkDestroyImage(device, swapchain->images[i], NULL);
+			gpu_free(allocator, &swapchain->image_allocations[i]);
+			vkDestroyBuffer(device, swapchain->readback_buffers[i].handle, NULL);
+			gpu_free(allocator, &swapchain->readback_buffers[i].allocation);
+		}
+	}
+	if(swapchain->command_buffers) {
+		vkFreeCommandBuffers(device, command_pool, (u32)swapchain->image_count, swapchain->command_buffers);
+	}
+	gpu_query_set_destroy(device, &swapchain->queries);
+	if(swapchain->handle != VK_NULL_HANDLE) {
+		vkDestroySwapchainKHR(device, swapchain->handle, NULL);
+	}
+	free(swapchain->images);
+	free(swapchain->image_allocations);
+	free(swapchain->readback_buffers);
+	free(swapchain->image_views);
+	free(swapchain->framebuffers);
+	free(swapchain->command_buffers);
+	free(swapchain->recorded_generations);
+	free(swapchain->image_timeline_values);
+	*swapchain = (Swapchain) { 0 };
+}
+
+// Framebuffers and command buffers are created once per swapchain image and live as long as the swapchain
+static void create_swapchain_image_resources(LogicalDevice logical_device, VkRenderPass render_pass,
+	VkCommandPool command_pool, GpuProfiler *gpu_profiler, Swapchain *swapchain) {
+	assert(!swapchain->framebuffers);
+	swapchain->framebuffers = (VkFramebuffer *)malloc(swapchain->image_count * sizeof(VkFramebuffer));
+	swapchain->command_buffers = (VkCommandBuffer *)malloc(swapchain->image_count * sizeof(VkCommandBuffer));
+	swapchain->recorded_generations = (u64 *)calloc(swapchain->image_count, sizeof(u64));
+	swapchain->image_timeline_values = (u64 *)calloc(swapchain->image_count, sizeof(u64));
+	assert(swapchain->framebuffers && swapchain->command_buffers &&
+		swapchain->recorded_generations && swapchain->image_timeline_values);
+
+	VkCommandBufferAllocateInfo command_buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = command_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = (u32)swapchain->image_count
+	};
+	VK_CHECK(vkAllocateCommandBuffers(logical_device.handle, &command_buffer_info, swapchain->command_buffers));
+	swapchain->queries = gpu_query_set_create(gpu_profiler, (u32)swapchain->image_count, false);
+
+	for(u32 i = 0; i < swapchain->image_count; ++i) {
+		VkFramebufferCreateInfo framebuffer_info = {
+			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+			.renderPass = render_pass,
+			.attachmentCount = 1,
+			.pAttachments = &swapchain->image_views[i],
+			.width = swapchain->extent.width,
+			.height = swapchain->extent.height,
+			.layers = 1
+		};
+		VK_CHECK(vkCreateFramebuffer(logical_device.handle, &framebuffer_info, NULL, &swapchain->framebuffers[i]));
+	}
+}
+
+// Refresh period of the display, the fastest one if the screen spans several outputs
+static u64 get_display_refresh_period_ns(Window window) {
+	u64 refresh_period_ns = 0;
+#ifdef _WIN32
+	MONITORINFOEX monitor_info = { .cbSize = sizeof(MONITORINFOEX) };
+	DEVMODE display_mode = { .dmSize = sizeof(DEVMODE) };
+	HMONITOR monitor = MonitorFromWindow(window.handle, MONITOR_DEFAULTTONEAREST);
+	// A frequency of 0 or 1 means the hardware default
+	if(GetMonitorInfo(monitor, (MONITORINFO *)&monitor_info) &&
+		EnumDisplaySettings(monitor_info.szDevice, ENUM_CURRENT_SETTINGS, &display_mode) &&
+		display_mode.dmDisplayFrequency > 1) {
+		refresh_period_ns = NANOSECONDS_PER_SECOND / display_mode.dmDisplayFrequency;
+	}
+#else
+	xcb_randr_get_screen_resources_current_reply_t *resources = xcb_randr_get_screen_resources_current_reply(
+		window.connection,
+		xcb_randr_get_screen_resources_current(window.connection, window.handle),
+		NULL
+	);
+	if(resources) {
+		xcb_randr_crtc_t *crtcs = xcb_randr_get_screen_resources_current_crtcs(resources);
+		xcb_randr_mode_info_t *modes = xcb_randr_get_screen_resources_current_modes(resources);
+		int num_crtcs = xcb_randr_get_screen_resources_current_crtcs_length(resources);
+		int num_modes = xcb_randr_get_screen_resources_current_modes_length(resources);
+
+		for(int i = 0; i < num_crtcs; ++i) {
+			xcb_randr_get_crtc_info_reply_t *crtc = xcb_randr_get_crtc_info_reply(
+				window.connection,
+				xcb_randr_get_crtc_info(window.connection, crtcs[i], resources->config_timestamp),
+				NULL
+			);
+			if(!crtc) {
+				continue;
+			}
+
+			for(int j = 0; j < num_modes; ++j) {
+				xcb_randr_mode_info_t mode = modes[j];
+				if(mode.id != crtc->mode || mode.dot_clock == 0) {
+					continue;
+				}
+
+				u64 period_ns = NANOSECONDS_PER_SECOND * mode.htotal * mode.vtotal / mode.dot_clock;
+				if(period_ns > 0 && (refresh_period_ns == 0 || period_ns < refresh_period_ns)) {
+					refresh_period_ns = period_ns;
+				}
+			}
+			free(crtc);
+		}
+		free(resources);
+	}
+#endif
+	return refresh_period_ns > 0 ? refresh_period_ns : DEFAULT_REFRESH_PERIOD_NS;
+}
+
+// A refresh period of zero disables pacing
+static FramePacer create_frame_pacer(u64 refresh_period_ns) {
+	u64 now = platform_get_time_ns();
+	return (FramePacer) {
+		.refresh_period_ns = refresh_period_ns,
+		.next_vblank_ns = now + refresh_period_ns,
+		.frame_start_ns = now,
+		.frame_time_estimate_ns = 0
 	};
 }
 
+static void frame_pacer_begin_frame(FramePacer *pacer) {
+	if(pacer->refresh_period_ns > 0) {
+		// Wake up just early enough for a frame as slow as the recent ones to finish in time
+		u64 lead_time_ns = pacer->frame_time_estimate_ns + FRAME_PACER_SLACK_NS;
+		if(pacer->next_vblank_ns > lead_time_ns) {
+			platform_sleep_until_ns(pacer->next_vblank_ns - lead_time_ns);
+		}
+	}
+	pacer->frame_start_ns = platform_get_time_ns();
+}
+
+static void frame_pacer_end_frame(FramePacer *pacer) {
+	u64 now = platform_get_time_ns();
+	u64 frame_time_ns = now - pacer->frame_start_ns;
+
+	// React to slow frames immediately, but only slowly trust faster ones
+	u64 estimate_ns = pacer->frame_time_estimate_ns;
+	pacer->frame_time_estimate_ns = frame_time_ns > estimate_ns ? frame_time_ns :
+		estimate_ns - (estimate_ns - frame_time_ns) / 16;
+
+	// Finishing after the scheduled vertical blank means the frame was missed or
+	// presentation blocked, either way the schedule is restarted from here
+	if(now > pacer->next_vblank_ns) {
+		pacer->next_vblank_ns = now + pacer->refresh_period_ns;
+	}
+	else {
+		pacer->next_vblank_ns += pacer->refresh_period_ns;
+	}
+}
+
 static void initialize_frame_resources(Renderer *renderer) {
 	VkSemaphoreCreateInfo semaphore_info = {
 		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
 	};
-	VkFenceCreateInfo fence_info = {
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-		.flags = VK_FENCE_CREATE_SIGNALED_BIT
-	};
 	VkCommandBufferAllocateInfo command_buffer_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
 		.commandPool = renderer->command_pool,
@@ -381,12 +900,12 @@ static void initialize_frame_resources(Renderer *renderer) {
 		VK_CHECK(vkAllocateCommandBuffers(renderer->logical_device.handle, &command_buffer_info, &renderer->command_buffers[i]));
 		VK_CHECK(vkCreateSemaphore(renderer->logical_device.handle, &semaphore_info, NULL, &renderer->image_available_semaphores[i]));
 		VK_CHECK(vkCreateSemaphore(renderer->logical_device.handle, &semaphore_info, NULL, &renderer->render_finished_semaphores[i]));
-		VK_CHECK(vkCreateFence(renderer->logical_device.handle, &fence_info, NULL, &renderer->fences[i]));
-		renderer->framebuffers[i] = VK_NULL_HANDLE;
+		renderer->frame_timeline_values[i] = 0;
 	}
 }
 
-static VkRenderPass create_render_pass(LogicalDevice logical_device, Swapchain swapchain) {
+static VkRenderPass create_render_pass(LogicalDevice logical_device, Swapchain swapchain,
+	VkImageLayout final_layout) {
 	VkRenderPassCreateInfo render_pass_info = {
 		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
 		.attachmentCount = 1,
@@ -398,7 +917,7 @@ static VkRenderPass create_render_pass(LogicalDevice logical_device, Swapchain s
 			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
 			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-			.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+			.finalLayout = final_layout
 		},
 		.subpassCount = 1,
 		.pSubpasses = &(VkSubpassDescription) {
@@ -426,39 +945,167 @@ static VkRenderPass create_render_pass(LogicalDevice logical_device, Swapchain s
 	return render_pass;
 }
 
-static VkShaderModule create_shader_module(VkDevice device, ShaderType shader_type, const char *shader_source) {
-	char path[FILENAME_MAX] = { 0 };
-	strcat(path, shader_source);
-	strcat(path, ".spv");
-    
-    FILE *file = fopen(path, "rb");
-    assert(file);
+// Loads <ATLAS_SHADER_DIR>/<name>.spv, so shaders can be iterated on without rebuilding.
+// Returns NULL when no override directory is set or the file cannot be read.
+static u32 *load_shader_override(const char *shader_source, u64 *size) {
+	const char *shader_dir = getenv("ATLAS_SHADER_DIR");
+	if(!shader_dir || !shader_dir[0]) {
+		return NULL;
+	}
+
+	char path[FILENAME_MAX];
+	snprintf(path, sizeof(path), "%s/%s.spv", shader_dir, shader_source);
+	FILE *file = fopen(path, "rb");
+	if(!file) {
+		printf("Could not open %s, using the embedded shader\n", path);
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long file_size = ftell(file);
+	rewind(file);
+
+	u32 *bytecode = file_size > 0 ? (u32 *)malloc(file_size) : NULL;
+	if(!bytecode || fread(bytecode, file_size, 1, file) != 1) {
+		printf("Could not read %s, using the embedded shader\n", path);
+		free(bytecode);
+		fclose(file);
+		return NULL;
+	}
+	fclose(file);
 
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
+	*size = (u64)file_size;
+	return bytecode;
+}
 
-    void *bytecode = malloc(file_size);
-    fread(bytecode, file_size, 1, file);
-    fclose(file);
+static VkShaderModule create_shader_module(VkDevice device, ShaderType shader_type, const char *shader_source) {
+	u64 code_size = 0;
+	u32 *override_code = load_shader_override(shader_source, &code_size);
+	const u32 *code = override_code;
+
+	for(u32 i = 0; !code && i < ARRAY_LENGTH(EMBEDDED_SHADERS); ++i) {
+		if(strcmp(EMBEDDED_SHADERS[i].name, shader_source) == 0) {
+			code = EMBEDDED_SHADERS[i].code;
+			code_size = EMBEDDED_SHADERS[i].size;
+		}
+	}
+	assert(code);
 
 	VkShaderModuleCreateInfo shader_module_info = {
 		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = file_size,
-		.pCode = bytecode
+		.codeSize = code_size,
+		.pCode = code
 	};
 
 	VkShaderModule shader_module = VK_NULL_HANDLE;
-	vkCreateShaderModule(device, &shader_module_info, NULL, &shader_module);
+	VK_CHECK(vkCreateShaderModule(device, &shader_module_info, NULL, &shader_module));
 
-	free(bytecode);
+	free(override_code);
 	return shader_module;
 }
 
+static bool is_pipeline_cache_compatible(PhysicalDevice physical_device, const void *data, u64 size) {
+	VkPipelineCacheHeaderVersionOne header;
+	if(size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+
+	VkPhysicalDeviceProperties *properties = &physical_device.properties.properties;
+	return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+		header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		header.vendorID == properties->vendorID &&
+		header.deviceID == properties->deviceID &&
+		memcmp(header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// Seeds the pipeline cache from the file written by the previous run. Drivers are supposed to reject
+// foreign data themselves, but not all of them do, so the header is checked against the device first
+// and a cache from another device or driver version is simply ignored.
+static VkPipelineCache create_pipeline_cache(PhysicalDevice physical_device, LogicalDevice logical_device,
+	const char *path) {
+	void *data = NULL;
+	long size = 0;
+
+	FILE *file = path[0] ? fopen(path, "rb") : NULL;
+	if(file) {
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		rewind(file);
+
+		data = size > 0 ? malloc(size) : NULL;
+		if(!data || fread(data, size, 1, file) != 1 || !is_pipeline_cache_compatible(physical_device, data, size)) {
+			free(data);
+			data = NULL;
+			size = 0;
+		}
+		fclose(file);
+	}
+
+	VkPipelineCacheCreateInfo pipeline_cache_info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = size,
+		.pInitialData = data
+	};
+
+	VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+	VkResult result = vkCreatePipelineCache(logical_device.handle, &pipeline_cache_info, NULL, &pipeline_cache);
+	if(result != VK_SUCCESS && data) {
+		// Retry empty, a stale cache must never keep the renderer from starting
+		pipeline_cache_info.initialDataSize = 0;
+		pipeline_cache_info.pInitialData = NULL;
+		result = vkCreatePipelineCache(logical_device.handle, &pipeline_cache_info, NULL, &pipeline_cache);
+	}
+	VK_CHECK(result);
+
+	free(data);
+	return pipeline_cache;
+}
+
+// Written to a temporary file first and then moved over the old cache, so that
+// a crash while writing never leaves a truncated cache behind
+static void save_pipeline_cache(VkDevice device, VkPipelineCache pipeline_cache, const char *path) {
+	if(!path[0]) {
+		return;
+	}
+
+	size_t size = 0;
+	if(vkGetPipelineCacheData(device, pipeline_cache, &size, NULL) != VK_SUCCESS || size == 0) {
+		return;
+	}
+	void *data = malloc(size);
+	assert(data);
+	if(vkGetPipelineCacheData(device, pipeline_cache, &size, data) != VK_SUCCESS) {
+		free(data);
+		return;
+	}
+
+	char temporary_path[FILENAME_MAX];
+	snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+	FILE *file = fopen(temporary_path, "wb");
+	if(file) {
+		bool written = fwrite(data, size, 1, file) == 1;
+		written = fclose(file) == 0 && written;
+		if(!written || !platform_replace_file(temporary_path, path)) {
+			remove(temporary_path);
+		}
+	}
+	free(data);
+}
+
+static void get_pipeline_cache_path(char *path, u64 path_size) {
+	path[0] = '\0';
+	char directory[FILENAME_MAX];
+	if(platform_get_cache_directory(directory, sizeof(directory))) {
+		int written = snprintf(path, path_size, "%s/pipeline_cache.bin", directory);
+		if(written < 0 || (u64)written >= path_size) {
+			path[0] = '\0';
+		}
+	}
+}
 
 static Pipeline create_rasterization_pipeline(VkInstance instance, LogicalDevice logical_device,
-	Swapchain swapchain, VkRenderPass render_pass,
-	DescriptorSet descriptor_set) {
+	VkPipelineCache pipeline_cache, VkRenderPass render_pass, DescriptorSet descriptor_set) {
 
 	VkPipelineLayoutCreateInfo layout_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -498,8 +1145,8 @@ static Pipeline create_rasterization_pipeline(VkInstance instance, LogicalDevice
 			.vertexBindingDescriptionCount = 1,
 			.pVertexBindingDescriptions = &(VkVertexInputBindingDescription) {
 				.binding = 0,
-				.stride = sizeof(Vertex),
-				.inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+				.stride = sizeof(GlyphInstance),
+				.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
 			},
 			.vertexAttributeDescriptionCount = 1,
 			.pVertexAttributeDescriptions = &(VkVertexInputAttributeDescription) {
@@ -513,18 +1160,18 @@ static Pipeline create_rasterization_pipeline(VkInstance instance, LogicalDevice
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
 			.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
 		},
+		// Viewport and scissor are set when recording, so the pipeline survives swapchain resizes
 		.pViewportState = &(VkPipelineViewportStateCreateInfo) {
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
 			.viewportCount = 1,
-			.pViewports = &(VkViewport) {
-				.width = (float)swapchain.extent.width,
-				.height = (float)swapchain.extent.height,
-				.minDepth = 0.0f,
-				.maxDepth = 1.0f
-			},
-			.scissorCount = 1,
-			.pScissors = &(VkRect2D) {
-				.extent = swapchain.extent
+			.scissorCount = 1
+		},
+		.pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+			.dynamicStateCount = 2,
+			.pDynamicStates = (VkDynamicState[]) {
+				VK_DYNAMIC_STATE_VIEWPORT,
+				VK_DYNAMIC_STATE_SCISSOR
 			}
 		},
 		.pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
@@ -557,7 +1204,7 @@ static Pipeline create_rasterization_pipeline(VkInstance instance, LogicalDevice
 	};
 
 	VkPipeline pipeline;
-	VK_CHECK(vkCreateGraphicsPipelines(logical_device.handle, VK_NULL_HANDLE, 1, &graphics_pipeline_info,
+	VK_CHECK(vkCreateGraphicsPipelines(logical_device.handle, pipeline_cache, 1, &graphics_pipeline_info,
 		NULL, &pipeline));
 
 	vkDestroyShaderModule(logical_device.handle, shader_stage_infos[0].module, NULL);
@@ -593,9 +1240,11 @@ static void transition_glyph_image(LogicalDevice logical_device, VkCommandBuffer
 	VkImageMemoryBarrier memory_barrier = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
 		.srcAccessMask = 0,
-		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
 		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
 		.image = image.handle,
 		.subresourceRange = {
 			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -604,77 +1253,55 @@ static void transition_glyph_image(LogicalDevice logical_device, VkCommandBuffer
 		}
 	};
 
-	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL,
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
 		0, NULL, 1, &memory_barrier);
-
 }
 
-static void end_one_time_command_buffer(LogicalDevice logical_device, VkCommandBuffer command_buffer,
-	VkCommandPool command_pool) {
-	VK_CHECK(vkEndCommandBuffer(command_buffer));
-
-	VkSubmitInfo submit_info = {
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &command_buffer
-	};
-
-	VkFenceCreateInfo fence_info = {
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO
-	};
-	VkFence fence;
-	VK_CHECK(vkCreateFence(logical_device.handle, &fence_info, NULL, &fence));
-
-	VK_CHECK(vkQueueSubmit(logical_device.graphics_queue, 1, &submit_info, fence));
-	VK_CHECK(vkWaitForFences(logical_device.handle, 1, &fence, VK_TRUE, UINT64_MAX));
-
-	vkFreeCommandBuffers(logical_device.handle, command_pool, 1, &command_buffer);
-	vkDestroyFence(logical_device.handle, fence, NULL);
-}
-
-// Function from Vulkan spec 1.0.183
-static u32 find_memory_type_index(VkPhysicalDeviceMemoryProperties memory_properties,
-	u32 memory_type_bits_requirements,
-	VkMemoryPropertyFlags required_properties) {
-	u32 memory_count = memory_properties.memoryTypeCount;
-
-	for(u32 memory_index = 0; memory_index < memory_count; ++memory_index) {
-		VkMemoryPropertyFlags properties = memory_properties.memoryTypes[memory_index].propertyFlags;
-		bool is_required_memory_type = memory_type_bits_requirements & (1 << memory_index);
-		bool has_required_properties = (properties & required_properties) == required_properties;
-
-		if(is_required_memory_type && has_required_properties) {
-			return (u32)memory_index;
+// Both halves of a queue family ownership transfer of the glyph atlas use the same barrier,
+// the release is recorded on the source queue and the acquire on the destination queue.
+// Within a single family this is a plain memory barrier.
+static void record_glyph_atlas_ownership_barrier(VkCommandBuffer command_buffer, Image image,
+	PhysicalDevice physical_device, VkAccessFlags src_access_mask, VkAccessFlags dst_access_mask,
+	VkPipelineStageFlags src_stage_mask, VkPipelineStageFlags dst_stage_mask) {
+	bool transfer_ownership = physical_device.compute_family_idx != physical_device.graphics_family_idx;
+	VkImageMemoryBarrier memory_barrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = src_access_mask,
+		.dstAccessMask = dst_access_mask,
+		.oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = transfer_ownership ? physical_device.compute_family_idx : VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = transfer_ownership ? physical_device.graphics_family_idx : VK_QUEUE_FAMILY_IGNORED,
+		.image = image.handle,
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.levelCount = 1,
+			.layerCount = 1
 		}
-	}
-
-	// Failed to find memory type
-	assert(false);
-	return UINT32_MAX;
-}
-
-static VkDeviceMemory allocate_memory(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties,
-	VkDeviceSize size, u32 memory_type_bits_requirements,
-	VkMemoryPropertyFlags memory_property_flags) {
-	VkMemoryAllocateInfo memory_allocate_info = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.allocationSize = size,
-		.memoryTypeIndex = find_memory_type_index(memory_properties, memory_type_bits_requirements,
-											   memory_property_flags)
 	};
 
-	VkDeviceMemory memory = VK_NULL_HANDLE;
-	VK_CHECK(vkAllocateMemory(device, &memory_allocate_info, NULL, &memory));
-	return memory;
+	vkCmdPipelineBarrier(command_buffer, src_stage_mask, dst_stage_mask, 0, 0, NULL,
+		0, NULL, 1, &memory_barrier);
 }
 
-static u64 align_up(u64 value, u64 alignment) {
-	return ((value + alignment - 1) / alignment) * alignment;
+// Submits without waiting, the command buffer is freed once the timeline reaches the returned value
+static u64 submit_one_time_command_buffer(VkCommandBuffer command_buffer, QueueTimeline *timeline,
+	RetiredResources *retired, const SubmitWait *waits, u32 num_waits) {
+	VK_CHECK(vkEndCommandBuffer(command_buffer));
+
+	u64 timeline_value = queue_timeline_submit(timeline, &command_buffer, 1, waits, num_waits, VK_NULL_HANDLE);
+	retire_resource(retired, (RetiredResource) {
+		.type = RETIRED_RESOURCE_COMMAND_BUFFER,
+		.timeline_value = timeline_value,
+		.command_buffer = command_buffer
+	});
+	return timeline_value;
 }
 
-static Image create_image_2d(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties,
-	u32 width, u32 height, VkFormat format) {
+static Image create_image_2d(GpuAllocator *allocator, u32 width, u32 height, VkFormat format,
+	VkImageUsageFlags usage) {
+	VkDevice device = allocator->device;
 	VkImageCreateInfo image_info = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
 		.imageType = VK_IMAGE_TYPE_2D,
@@ -688,7 +1315,7 @@ static Image create_image_2d(VkDevice device, VkPhysicalDeviceMemoryProperties m
 		.arrayLayers = 1,
 		.samples = VK_SAMPLE_COUNT_1_BIT,
 		.tiling = VK_IMAGE_TILING_OPTIMAL,
-		.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+		.usage = usage
 	};
 	VkImage image;
 	VK_CHECK(vkCreateImage(device, &image_info, NULL, &image));
@@ -696,11 +1323,9 @@ static Image create_image_2d(VkDevice device, VkPhysicalDeviceMemoryProperties m
 	VkMemoryRequirements memory_requirements;
 	vkGetImageMemoryRequirements(device, image, &memory_requirements);
 
-	u64 aligned_size = align_up(memory_requirements.size, memory_requirements.alignment);
-	VkDeviceMemory memory = allocate_memory(device, memory_properties, aligned_size,
-		memory_requirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	VK_CHECK(vkBindImageMemory(device, image, memory, 0));
+	GpuAllocation allocation = gpu_allocate(allocator, memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		0, GPU_LIFETIME_LONG);
+	VK_CHECK(vkBindImageMemory(device, image, allocation.memory, allocation.offset));
 
 	VkImageViewCreateInfo image_view_info = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -725,12 +1350,15 @@ static Image create_image_2d(VkDevice device, VkPhysicalDeviceMemoryProperties m
 	return (Image) {
 		.handle = image,
 		.view = image_view,
-		.memory = memory
+		.allocation = allocation
 	};
 }
 
-static MappedBuffer create_mapped_buffer(VkDevice device, VkPhysicalDeviceMemoryProperties memory_properties,
-	VkBufferUsageFlags usage, u64 size) {
+// The preferred properties are only used if a host-visible memory type has them,
+// e.g. VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT for buffers the GPU reads directly.
+static MappedBuffer create_mapped_buffer(GpuAllocator *allocator, VkBufferUsageFlags usage, u64 size,
+	VkMemoryPropertyFlags preferred_properties, GpuLifetime lifetime) {
+	VkDevice device = allocator->device;
 	VkBufferCreateInfo buffer_info = {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
 		.size = size,
@@ -742,61 +1370,432 @@ static MappedBuffer create_mapped_buffer(VkDevice device, VkPhysicalDeviceMemory
 	VkMemoryRequirements memory_requirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memory_requirements);
 
-	u64 aligned_size = align_up(memory_requirements.size, memory_requirements.alignment);
-	VkDeviceMemory memory = allocate_memory(device, memory_properties, aligned_size,
-		memory_requirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-	VK_CHECK(vkBindBufferMemory(device, buffer, memory, 0));
-
-	void *mapped_data = NULL;
-	VK_CHECK(vkMapMemory(device, memory, 0, aligned_size, 0, &mapped_data));
+	// Host-visible memory stays mapped for its whole lifetime, the allocation points into that mapping
+	GpuAllocation allocation = gpu_allocate(allocator, memory_requirements,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, preferred_properties, lifetime);
+	VK_CHECK(vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset));
 
 	return (MappedBuffer) {
 		.handle = buffer,
-			.data = mapped_data,
-			.memory = memory
+		.data = allocation.mapped,
+		.allocation = allocation
 	};
 }
 
-static float fixed_to_float(signed long x) {
-	return (float)x / 64.0f;
-}
+static Buffer create_device_local_buffer(GpuAllocator *allocator, VkBufferUsageFlags usage, u64 size) {
+	VkDevice device = allocator->device;
+	VkBufferCreateInfo buffer_info = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = usage,
+	};
+	VkBuffer buffer;
+	VK_CHECK(vkCreateBuffer(device, &buffer_info, NULL, &buffer));
 
-// https://members.loria.fr/samuel.hornus/quadratic-arc-length.html
-static float get_bezier_arc_length(GlyphPoint a, GlyphPoint b, GlyphPoint c) {
-	float Bx = b.x - a.x;
-	float By = b.y - a.y;
-	float Fx = c.x - b.x;
-	float Fy = c.y - b.y;
-	float Ax = Fx - Bx;
-	float Ay = Fy - By;
-	float A_dot_B = Ax * Bx + Ay * By;
-	float A_dot_F = Ax * Fx + Ay * Fy;
-	float B_magn = sqrt(Bx * Bx + By * By);
-	float F_magn = sqrt(Fx * Fx + Fy * Fy);
-	float A_magn = sqrt(Ax * Ax + Ay * Ay);
+	VkMemoryRequirements memory_requirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memory_requirements);
+
+	GpuAllocation allocation = gpu_allocate(allocator, memory_requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		0, GPU_LIFETIME_LONG);
+	VK_CHECK(vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset));
 
-	if (B_magn == 0.0f || F_magn == 0.0f || A_magn == 0.0f) {
-		return 0.0f;
+	return (Buffer) {
+		.handle = buffer,
+		.allocation = allocation
+	};
+}
+
+// Creates a buffer the GPU reads from and fills it with data. In staging mode the data is
+// copied through a temporary staging buffer on the timeline's queue, the CPU does not wait for
+// the copy and the staging buffer is retired with it.
+static Buffer create_buffer_with_data(LogicalDevice logical_device, GpuAllocator *allocator,
+	VkCommandPool command_pool, QueueTimeline *timeline, RetiredResources *retired, UploadMode upload_mode,
+	VkBufferUsageFlags usage, const void *data, u64 size) {
+	if(upload_mode == UPLOAD_MODE_MAPPED_DIRECT) {
+		MappedBuffer buffer = create_mapped_buffer(allocator, usage, size, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			GPU_LIFETIME_LONG);
+		memcpy(buffer.data, data, size);
+		return (Buffer) {
+			.handle = buffer.handle,
+			.allocation = buffer.allocation
+		};
 	}
 
-	float l1 = (F_magn * A_dot_F - B_magn * A_dot_B) / (A_magn * A_magn);
-	float l2 = ((B_magn * B_magn) / A_magn) - ((A_dot_B * A_dot_B) / (A_magn * A_magn * A_magn));
-	float l3 = logf(A_magn * F_magn + A_dot_F) - logf(A_magn * B_magn + A_dot_B);
+	// Staging buffers only live until the copy has completed
+	MappedBuffer staging_buffer = create_mapped_buffer(allocator, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size, 0,
+		GPU_LIFETIME_TRANSIENT);
+	memcpy(staging_buffer.data, data, size);
+
+	Buffer buffer = create_device_local_buffer(allocator, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+
+	VkCommandBuffer command_buffer = start_one_time_command_buffer(logical_device, command_pool);
+	vkCmdCopyBuffer(command_buffer, staging_buffer.handle, buffer.handle, 1, &(VkBufferCopy) {
+		.size = size
+	});
+
+	// Make the copy visible to every later submission that reads the buffer. Compute queues
+	// do not support vertex input, so that access is only included for vertex buffers.
+	VkBufferMemoryBarrier buffer_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+			((usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) ? VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT : 0),
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = buffer.handle,
+		.size = VK_WHOLE_SIZE
+	};
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0, 0, NULL, 1, &buffer_barrier, 0, NULL);
+
+	u64 timeline_value = submit_one_time_command_buffer(command_buffer, timeline, retired, NULL, 0);
+	retire_resource(retired, (RetiredResource) {
+		.type = RETIRED_RESOURCE_BUFFER,
+		.timeline_value = timeline_value,
+		.buffer = {
+			.handle = staging_buffer.handle,
+			.allocation = staging_buffer.allocation
+		}
+	});
+	return buffer;
+}
+
+// Stands in for the swapchain when rendering headless, one image per frame in flight. The
+// images are used round robin and copied to their readback buffer at the end of every frame.
+static Swapchain create_offscreen_swapchain(GpuAllocator *allocator, VkExtent2D extent) {
+	u64 image_count = MAX_FRAMES_IN_FLIGHT;
+	VkImage *images = (VkImage *)malloc(image_count * sizeof(VkImage));
+	VkImageView *image_views = (VkImageView *)malloc(image_count * sizeof(VkImageView));
+	GpuAllocation *image_allocations = (GpuAllocation *)malloc(image_count * sizeof(GpuAllocation));
+	MappedBuffer *readback_buffers = (MappedBuffer *)malloc(image_count * sizeof(MappedBuffer));
+	assert(images && image_views && image_allocations && readback_buffers);
 
-	if (isnan(l3)) {
-		return 0.0f;
+	VkFormat format = VK_FORMAT_B8G8R8A8_UNORM;
+	for(u32 i = 0; i < image_count; ++i) {
+		Image image = create_image_2d(allocator, extent.width, extent.height, format,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+		images[i] = image.handle;
+		image_views[i] = image.view;
+		image_allocations[i] = image.allocation;
+
+		// Reading uncached memory from the CPU is very slow, prefer cached memory if there is any
+		readback_buffers[i] = create_mapped_buffer(allocator, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			(u64)extent.width * extent.height * 4, VK_MEMORY_PROPERTY_HOST_CACHED_BIT, GPU_LIFETIME_LONG);
 	}
 
-	return l1 + l2 * l3;
+	return (Swapchain) {
+		.handle = VK_NULL_HANDLE,
+		.image_count = image_count,
+		.format = format,
+		.present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR,
+		.extent = extent,
+		.images = images,
+		.image_views = image_views,
+		.framebuffers = NULL,
+		.command_buffers = NULL,
+		.recorded_generations = NULL,
+		.image_timeline_values = NULL,
+		.image_allocations = image_allocations,
+		.readback_buffers = readback_buffers
+	};
+}
+
+static VertexRing create_vertex_ring(GpuAllocator *allocator, UploadMode upload_mode, u64 capacity,
+	u64 min_capacity) {
+	u64 size = capacity * sizeof(GlyphInstance);
+	if(upload_mode == UPLOAD_MODE_MAPPED_DIRECT) {
+		return (VertexRing) {
+			.buffer = create_mapped_buffer(allocator, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, size,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GPU_LIFETIME_LONG),
+			.capacity = capacity,
+			.min_capacity = min_capacity
+		};
+	}
+
+	return (VertexRing) {
+		.buffer = create_mapped_buffer(allocator, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size, 0, GPU_LIFETIME_LONG),
+		.device_buffer = create_device_local_buffer(allocator,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size),
+		.capacity = capacity,
+		.min_capacity = min_capacity,
+		.head = 0,
+		.used = 0
+	};
+}
+
+static void destroy_vertex_ring(VkDevice device, GpuAllocator *allocator, VertexRing *ring) {
+	vkDestroyBuffer(device, ring->buffer.handle, NULL);
+	gpu_free(allocator, &ring->buffer.allocation);
+	vkDestroyBuffer(device, ring->device_buffer.handle, NULL);
+	gpu_free(allocator, &ring->device_buffer.allocation);
+	*ring = (VertexRing) { 0 };
+}
+
+// Destroys every retired resource the GPU is done with
+static void destroy_retired_resources(VkDevice device, GpuAllocator *allocator, VkCommandPool command_pool,
+	RetiredResources *retired, u64 completed_value) {
+	u32 remaining = 0;
+	for(u32 i = 0; i < retired->count; ++i) {
+		RetiredResource *resource = &retired->resources[i];
+		if(resource->timeline_value > completed_value) {
+			retired->resources[remaining++] = *resource;
+			continue;
+		}
+
+		switch(resource->type) {
+		case RETIRED_RESOURCE_BUFFER:
+			vkDestroyBuffer(device, resource->buffer.handle, NULL);
+			gpu_free(allocator, &resource->buffer.allocation);
+			break;
+		case RETIRED_RESOURCE_COMMAND_BUFFER:
+			vkFreeCommandBuffers(device, command_pool, 1, &resource->command_buffer);
+			break;
+		case RETIRED_RESOURCE_VERTEX_RING:
+			destroy_vertex_ring(device, allocator, &resource->vertex_ring);
+			break;
+		case RETIRED_RESOURCE_SWAPCHAIN:
+			destroy_swapchain(device, allocator, command_pool, &resource->swapchain);
+			break;
+		}
+	}
+	retired->count = remaining;
+}
+
+static u32 get_lines_on_screen(VkExtent2D extent, GlyphMetrics metrics) {
+	return (u32)ceil((float)extent.height / metrics.cell_height);
+}
+
+// Enough glyph instances to fill every cell of the window once for each frame in flight.
+static u64 get_vertex_ring_capacity_for_extent(VkExtent2D extent, GlyphMetrics metrics) {
+	u64 columns = (u64)ceil(extent.width / (metrics.glyph_width / 3.0f));
+	u64 rows = (u64)ceil(extent.height / metrics.glyph_height);
+	return MAX(columns * rows, 1024) * MAX_FRAMES_IN_FLIGHT;
+}
+
+// Must only be called once the timeline has passed the value of the frame, regions are
+// retired in the same order they were allocated in.
+static void vertex_ring_retire(VertexRing *ring, u32 frame_index) {
+	assert(ring->used >= ring->regions[frame_index].consumed);
+	ring->used -= ring->regions[frame_index].consumed;
+	ring->regions[frame_index] = (VertexRegion) { 0 };
+}
+
+// Returns the number of vertices an allocation of count vertices consumes,
+// including the skipped remainder of the buffer when it has to wrap around.
+static u64 vertex_ring_get_consumed_count(VertexRing *ring, u64 count) {
+	if(ring->head + count > ring->capacity) {
+		return ring->capacity - ring->head + count;
+	}
+	return count;
+}
+
+static bool vertex_ring_fits(VertexRing *ring, u64 count) {
+	return count <= ring->capacity &&
+		ring->used + vertex_ring_get_consumed_count(ring, count) <= ring->capacity;
+}
+
+static u64 vertex_ring_allocate(VertexRing *ring, u32 frame_index, u64 count) {
+	assert(ring->regions[frame_index].consumed == 0);
+	assert(vertex_ring_fits(ring, count) && "Vertex ring is full");
+
+	// Regions are kept contiguous, if the allocation does not fit
+	// before the end of the buffer the remainder is skipped.
+	u64 consumed = vertex_ring_get_consumed_count(ring, count);
+	u64 offset = consumed > count ? 0 : ring->head;
+
+	ring->head = offset + count;
+	ring->used += consumed;
+	ring->regions[frame_index] = (VertexRegion) {
+		.offset = offset,
+		.count = count,
+		.consumed = consumed
+	};
+
+	ring->peak_count = MAX(ring->peak_count, count);
+	return offset;
+}
+
+// Hands the newest region over to a later frame that draws the same vertices,
+// it is then retired together with that frame.
+static void vertex_ring_move_region(VertexRing *ring, u32 from_frame_index, u32 to_frame_index) {
+	if(from_frame_index == to_frame_index) {
+		return;
+	}
+	assert(ring->regions[to_frame_index].consumed == 0);
+	ring->regions[to_frame_index] = ring->regions[from_frame_index];
+	ring->regions[from_frame_index] = (VertexRegion) { 0 };
+}
+
+static GlyphInstanceBlock *get_glyph_instance_block(GlyphInstanceCache *cache, u32 line) {
+	if(line >= cache->num_blocks) {
+		u32 num_blocks = MAX(cache->num_blocks, 64);
+		while(num_blocks <= line) {
+			num_blocks *= 2;
+		}
+		cache->blocks = realloc(cache->blocks, num_blocks * sizeof(GlyphInstanceBlock));
+		assert(cache->blocks);
+		memset(&cache->blocks[cache->num_blocks], 0,
+			(num_blocks - cache->num_blocks) * sizeof(GlyphInstanceBlock));
+		cache->num_blocks = num_blocks;
+	}
+	return &cache->blocks[line];
+}
+
+// Re-encodes the block only if the line or the column it starts at changed since the
+// block was last packed, returns whether it did. The font is loaded once when the renderer
+// is created, reloading it would have to invalidate every block as well.
+static bool update_glyph_instance_block(GlyphInstanceBlock *block, const GlyphCellTable *cell_table,
+	const char *content, u32 length, u32 version, u32 column, u32 line) {
+	if(block->valid && block->version == version && block->column == column) {
+		assert(block->count == length);
+		return false;
+	}
+
+	if(length > block->capacity) {
+		block->capacity = MAX(length, block->capacity * 2);
+		block->instances = realloc(block->instances, block->capacity * sizeof(GlyphInstance));
+		assert(block->instances);
+	}
+
+	// The row holds the document line, the offset to the first visible
+	// line is applied in the vertex shader
+	pack_glyph_instances(cell_table, content, length, column, line & 0xFFFF, block->instances);
+	block->count = length;
+	block->version = version;
+	block->column = column;
+	block->valid = true;
+	return true;
+}
+
+static void destroy_glyph_instance_cache(GlyphInstanceCache *cache) {
+	for(u32 i = 0; i < cache->num_blocks; ++i) {
+		free(cache->blocks[i].instances);
+	}
+	free(cache->blocks);
+	*cache = (GlyphInstanceCache) { 0 };
+}
+
+static float fixed_to_float(signed long x) {
+	return (float)x / 64.0f;
+}
+
+static void push_glyph_curve(TessellationContext *context, GlyphLine line, GlyphPoint control) {
+	if(context->num_lines == context->capacity) {
+		context->capacity = MAX(context->capacity * 2, INITIAL_TESSELLATION_LINES);
+		context->lines = (GlyphLine *)realloc(context->lines, context->capacity * sizeof(GlyphLine));
+		assert(context->lines);
+		if(context->rasterizer == GLYPH_RASTERIZER_CURVES) {
+			context->controls = (GlyphPoint *)realloc(context->controls, context->capacity * sizeof(GlyphPoint));
+			assert(context->controls);
+		}
+	}
+	if(context->rasterizer == GLYPH_RASTERIZER_CURVES) {
+		context->controls[context->num_lines] = control;
+	}
+	context->lines[context->num_lines++] = line;
+}
+
+static void push_glyph_line(TessellationContext *context, GlyphLine line) {
+	push_glyph_curve(context, line, (GlyphPoint) { (line.a.x + line.b.x) * 0.5f, (line.a.y + line.b.y) * 0.5f });
 }
 
 static void add_straight_line(GlyphPoint p1, GlyphPoint p2, TessellationContext *context) {
-    assert(context->num_lines < MAX_TOTAL_GLYPH_LINES);
-	context->lines[context->num_lines++] = p1.y > p2.y ?
-		(GlyphLine) { p1, p2 } : (GlyphLine) { p2, p1 };
-	return;
+	push_glyph_line(context, p1.y > p2.y ? (GlyphLine) { p1, p2 } : (GlyphLine) { p2, p1 });
+}
+
+// A chord over a parameter step h deviates at most max|B''| * h^2 / 8 from the curve (Wang's
+// formula). For a Bézier curve of degree d, max|B''| is d * (d - 1) times the largest second
+// difference of its control points, so n uniform steps keep the deviation below the tolerance
+// once n^2 >= d * (d - 1) * max_second_difference / (8 * tolerance). Gentle curves get few
+// lines and tight ones more, and the count only grows with the square root of the font size.
+static u32 get_flattening_steps(float max_second_difference, u32 degree, TessellationContext *context) {
+	float n_squared = degree * (degree - 1) * max_second_difference / (8.0f * context->flattening_tolerance);
+	u32 number_of_steps = (u32)ceilf(sqrtf(n_squared));
+	return MIN(MAX(number_of_steps, 1), MAX_SEGMENTS_PER_CURVE);
+}
+
+static float get_second_difference(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3) {
+	float dx = p1.x - 2.0f * p2.x + p3.x;
+	float dy = p1.y - 2.0f * p2.y + p3.y;
+	return sqrtf(dx * dx + dy * dy);
+}
+
+static void add_monotonic_curve(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, TessellationContext *context) {
+	push_glyph_curve(context, p1.y > p3.y ? (GlyphLine) { p1, p3 } : (GlyphLine) { p3, p1 }, p2);
+}
+
+static GlyphPoint lerp_glyph_point(GlyphPoint a, GlyphPoint b, float t) {
+	return (GlyphPoint) { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t };
+}
+
+// Keeps the curve for GLYPH_RASTERIZER_CURVES, split at its extremum in y so every sample
+// row crosses each part at most once
+static void add_quadratic_curve(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, TessellationContext *context) {
+	float denominator = p1.y - 2.0f * p2.y + p3.y;
+	float t = denominator != 0.0f ? (p1.y - p2.y) / denominator : 0.0f;
+	if(t <= 0.0f || t >= 1.0f) {
+		add_monotonic_curve(p1, p2, p3, context);
+		return;
+	}
+
+	GlyphPoint q = lerp_glyph_point(p1, p2, t);
+	GlyphPoint r = lerp_glyph_point(p2, p3, t);
+	GlyphPoint m = lerp_glyph_point(q, r, t);
+	// The tangent is horizontal at the extremum, rounding must not make either half turn back
+	q.y = m.y;
+	r.y = m.y;
+	add_monotonic_curve(p1, q, m, context);
+	add_monotonic_curve(m, r, p3, context);
+}
+
+static GlyphPoint get_cubic_derivative(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, GlyphPoint p4, float t) {
+	float u = 1.0f - t;
+	float w1 = 3.0f * u * u;
+	float w2 = 6.0f * u * t;
+	float w3 = 3.0f * t * t;
+	return (GlyphPoint) {
+		w1 * (p2.x - p1.x) + w2 * (p3.x - p2.x) + w3 * (p4.x - p3.x),
+		w1 * (p2.y - p1.y) + w2 * (p3.y - p2.y) + w3 * (p4.y - p3.y)
+	};
+}
+
+// Approximates a cubic with quadratics for GLYPH_RASTERIZER_CURVES. Each piece keeps the end
+// points of its part of the cubic and takes the control point that best matches both tangents.
+// Its error is at most sqrt(3) / 36 * |p4 - 3 * p3 + 3 * p2 - p1| * h^3 for a parameter step h,
+// so the number of pieces grows with the cube root of the error over the tolerance.
+static void add_cubic_as_quadratic_curves(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, GlyphPoint p4,
+	TessellationContext *context) {
+	float dx = p4.x - 3.0f * p3.x + 3.0f * p2.x - p1.x;
+	float dy = p4.y - 3.0f * p3.y + 3.0f * p2.y - p1.y;
+	float error = 0.0481125f * sqrtf(dx * dx + dy * dy);
+	u32 number_of_pieces = (u32)ceilf(cbrtf(error / context->flattening_tolerance));
+	number_of_pieces = MIN(MAX(number_of_pieces, 1), MAX_SEGMENTS_PER_CURVE);
+	float step_fraction = 1.0f / number_of_pieces;
+
+	GlyphPoint a = p1;
+	GlyphPoint a_tangent = get_cubic_derivative(p1, p2, p3, p4, 0.0f);
+	for(u32 i = 1; i <= number_of_pieces; ++i) {
+		float t = i * step_fraction;
+		float u = 1.0f - t;
+		float w1 = u * u * u;
+		float w2 = 3.0f * u * u * t;
+		float w3 = 3.0f * u * t * t;
+		float w4 = t * t * t;
+		GlyphPoint b = i == number_of_pieces ? p4 : (GlyphPoint) {
+			w1 * p1.x + w2 * p2.x + w3 * p3.x + w4 * p4.x,
+			w1 * p1.y + w2 * p2.y + w3 * p3.y + w4 * p4.y
+		};
+		GlyphPoint b_tangent = get_cubic_derivative(p1, p2, p3, p4, t);
+
+		// Midpoint of the controls that would match the tangent at either end of the piece
+		GlyphPoint control = {
+			(a.x + b.x) * 0.5f + (a_tangent.x - b_tangent.x) * step_fraction * 0.25f,
+			(a.y + b.y) * 0.5f + (a_tangent.y - b_tangent.y) * step_fraction * 0.25f
+		};
+		add_quadratic_curve(a, control, b, context);
+		a = b;
+		a_tangent = b_tangent;
+	}
 }
 
 static void add_quadratic_spline(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, TessellationContext *context) {
@@ -804,9 +1803,12 @@ static void add_quadratic_spline(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, Te
 		add_straight_line(p1, p3, context);
 		return;
 	}
+	if(context->rasterizer == GLYPH_RASTERIZER_CURVES) {
+		add_quadratic_curve(p1, p2, p3, context);
+		return;
+	}
 
-	float length = get_bezier_arc_length(p1, p2, p3);
-	u32 number_of_steps = length > 0.0f ? (u32)ceil(length / 0.5f) : 25;
+	u32 number_of_steps = get_flattening_steps(get_second_difference(p1, p2, p3), 2, context);
 	float step_fraction = 1.0f / number_of_steps;
 
 	for(u32 i = 0; i < number_of_steps; ++i) {
@@ -817,11 +1819,43 @@ static void add_quadratic_spline(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, Te
 		float bx = (1 - t2) * ((1 - t2) * p1.x + t2 * p2.x) + t2 * ((1 - t2) * p2.x + t2 * p3.x);
 		float by = (1 - t2) * ((1 - t2) * p1.y + t2 * p2.y) + t2 * ((1 - t2) * p2.y + t2 * p3.y);
 
-		assert(context->num_lines < MAX_TOTAL_GLYPH_LINES);
-		context->lines[context->num_lines++] =
-			ay > by ? (GlyphLine) { { ax, ay }, { bx, by } } :
-			(GlyphLine) { { bx, by }, { ax, ay }
+		push_glyph_line(context, ay > by ?
+			(GlyphLine) { { ax, ay }, { bx, by } } :
+			(GlyphLine) { { bx, by }, { ax, ay } });
+	}
+}
+
+static void add_cubic_spline(GlyphPoint p1, GlyphPoint p2, GlyphPoint p3, GlyphPoint p4,
+	TessellationContext *context) {
+	if ((p1.x == p2.x && p2.x == p3.x && p3.x == p4.x) || (p1.y == p2.y && p2.y == p3.y && p3.y == p4.y)) {
+		add_straight_line(p1, p4, context);
+		return;
+	}
+	if(context->rasterizer == GLYPH_RASTERIZER_CURVES) {
+		add_cubic_as_quadratic_curves(p1, p2, p3, p4, context);
+		return;
+	}
+
+	float max_second_difference = MAX(get_second_difference(p1, p2, p3), get_second_difference(p2, p3, p4));
+	u32 number_of_steps = get_flattening_steps(max_second_difference, 3, context);
+	float step_fraction = 1.0f / number_of_steps;
+
+	GlyphPoint a = p1;
+	for(u32 i = 1; i <= number_of_steps; ++i) {
+		float t = i * step_fraction;
+		float u = 1.0f - t;
+		float w1 = u * u * u;
+		float w2 = 3.0f * u * u * t;
+		float w3 = 3.0f * u * t * t;
+		float w4 = t * t * t;
+		// The last point is taken as is, so the next segment of the contour starts exactly where this one ends
+		GlyphPoint b = i == number_of_steps ? p4 : (GlyphPoint) {
+			w1 * p1.x + w2 * p2.x + w3 * p3.x + w4 * p4.x,
+			w1 * p1.y + w2 * p2.y + w3 * p3.y + w4 * p4.y
 		};
+
+		add_straight_line(a, b, context);
+		a = b;
 	}
 }
 
@@ -861,8 +1895,18 @@ static int outline_conic_to(const FT_Vector* control, const FT_Vector* to, void
 }
 static int outline_cubic_to(const FT_Vector* control1, const FT_Vector* control2, 
 	const FT_Vector* to, void *user) {
-	assert(false);
-	return 1;
+	TessellationContext *context = (TessellationContext *)user;
+	float x = fixed_to_float(to->x);
+	float y = fixed_to_float(to->y);
+	add_cubic_spline(
+		context->last_point,
+		(GlyphPoint) { fixed_to_float(control1->x), fixed_to_float(control1->y) },
+		(GlyphPoint) { fixed_to_float(control2->x), fixed_to_float(control2->y) },
+		(GlyphPoint) { x, y },
+		context
+	);
+	context->last_point = (GlyphPoint) { x, y };
+	return 0;
 }
 
 static FT_Outline_Funcs outline_funcs = {
@@ -872,56 +1916,300 @@ static FT_Outline_Funcs outline_funcs = {
 	.cubic_to = outline_cubic_to
 };
 
-static int cmp_glyph_lines(const void* l1, const void* l2) {
-	float l1y = (*(GlyphLine *)l1).a.y;
-	float l2y = (*(GlyphLine *)l2).a.y;
-	return (l2y > l1y) - (l2y < l1y);
+// Maps a float to an unsigned integer that compares the same way. Positive floats get their sign
+// bit set, negative floats count down with growing magnitude, so all of their bits are flipped.
+static u32 float_to_ordered_u32(float value) {
+	u32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
 }
 
-static TessellatedGlyphs tessellate_glyphs(const char *font_path, u32 font_size) {
-	FT_Library freetype_library;
-	FT_Error err = FT_Init_FreeType(&freetype_library);
-	assert(!err);
+// Sorts the lines of each glyph by the y of their upper end point, descending. The glyphs must
+// be consecutive at the end of the line buffer. All of them are sorted at once by an LSD radix
+// sort on a key of the glyph index above the ordered y, one pass per byte of the key. Bytes that
+// are the same in every key, like the upper bytes of the glyph index, do not need a pass. The
+// control points of curves are moved along with their lines.
+static void sort_glyph_lines(TessellationContext *context, const GlyphOffset *glyph_offsets, u32 num_glyphs) {
+	u32 first_line = glyph_offsets[0].offset;
+	u32 num_lines = context->num_lines - first_line;
+	if(num_lines < 2) {
+		return;
+	}
+
+	if(num_lines > context->sort_capacity) {
+		free(context->sort_keys);
+		free(context->sort_lines);
+		free(context->sort_controls);
+		context->sort_capacity = MAX(num_lines, INITIAL_TESSELLATION_LINES);
+		context->sort_keys = (u64 *)malloc(2 * context->sort_capacity * sizeof(u64));
+		context->sort_lines = (GlyphLine *)malloc(context->sort_capacity * sizeof(GlyphLine));
+		assert(context->sort_keys && context->sort_lines);
+		context->sort_controls = NULL;
+		if(context->controls) {
+			context->sort_controls = (GlyphPoint *)malloc(context->sort_capacity * sizeof(GlyphPoint));
+			assert(context->sort_controls);
+		}
+	}
+
+	u64 *keys = context->sort_keys;
+	u64 *scratch_keys = context->sort_keys + context->sort_capacity;
+	GlyphLine *lines = &context->lines[first_line];
+	GlyphLine *scratch_lines = context->sort_lines;
+	GlyphPoint *controls = context->controls ? &context->controls[first_line] : NULL;
+	GlyphPoint *scratch_controls = context->sort_controls;
+
+	// The histograms of all digits are counted in a single pass over the keys
+	u32 histograms[sizeof(u64)][RADIX_SORT_BUCKETS] = { 0 };
+	for(u32 i = 0; i < num_glyphs; ++i) {
+		GlyphOffset glyph = glyph_offsets[i];
+		for(u32 j = glyph.offset; j < glyph.offset + glyph.num_lines; ++j) {
+			u64 key = ((u64)i << 32) | (u32)~float_to_ordered_u32(context->lines[j].a.y);
+			keys[j - first_line] = key;
+			for(u32 digit = 0; digit < sizeof(u64); ++digit) {
+				++histograms[digit][(key >> (digit * RADIX_SORT_DIGIT_BITS)) & (RADIX_SORT_BUCKETS - 1)];
+			}
+		}
+	}
 
+	for(u32 digit = 0; digit < sizeof(u64); ++digit) {
+		u32 shift = digit * RADIX_SORT_DIGIT_BITS;
+		u32 *histogram = histograms[digit];
+		if(histogram[(keys[0] >> shift) & (RADIX_SORT_BUCKETS - 1)] == num_lines) {
+			continue;
+		}
+
+		u32 bucket_offset = 0;
+		for(u32 i = 0; i < RADIX_SORT_BUCKETS; ++i) {
+			u32 count = histogram[i];
+			histogram[i] = bucket_offset;
+			bucket_offset += count;
+		}
+		for(u32 i = 0; i < num_lines; ++i) {
+			u32 destination = histogram[(keys[i] >> shift) & (RADIX_SORT_BUCKETS - 1)]++;
+			scratch_keys[destination] = keys[i];
+			scratch_lines[destination] = lines[i];
+			if(controls) {
+				scratch_controls[destination] = controls[i];
+			}
+		}
+
+		u64 *swap_keys = keys;
+		keys = scratch_keys;
+		scratch_keys = swap_keys;
+		GlyphLine *swap_lines = lines;
+		lines = scratch_lines;
+		scratch_lines = swap_lines;
+		GlyphPoint *swap_controls = controls;
+		controls = scratch_controls;
+		scratch_controls = swap_controls;
+	}
+
+	if(lines != &context->lines[first_line]) {
+		memcpy(&context->lines[first_line], lines, num_lines * sizeof(GlyphLine));
+		if(controls) {
+			memcpy(&context->controls[first_line], controls, num_lines * sizeof(GlyphPoint));
+		}
+	}
+}
+
+static FT_Face create_font_face(FT_Library freetype_library, const FT_Byte *font_data, FT_Long font_data_size,
+	u32 font_size) {
 	FT_Face freetype_face;
-	err = FT_New_Face(freetype_library, font_path, 0, &freetype_face);
-	assert(!err);
+	FT_Error err = FT_New_Memory_Face(freetype_library, font_data, font_data_size, 0, &freetype_face);
+	if(err) {
+		return NULL;
+	}
 
 	// TODO: Support variable .ttf fonts with overlapping outlines.
 	// https://github.com/microsoft/cascadia-code/issues/350
 
 	err = FT_Set_Char_Size(freetype_face, (font_size << 6) * 3, font_size << 6, 0, 0);
+	if(err) {
+		FT_Done_Face(freetype_face);
+		return NULL;
+	}
+	return freetype_face;
+}
+
+// Appends the sorted lines of one glyph to the context, the offset is relative to its line buffer
+static GlyphOffset tessellate_glyph(FT_Face freetype_face, u32 codepoint, TessellationContext *context) {
+	u32 offset = context->num_lines;
+
+	FT_Error err = FT_Load_Char(freetype_face, codepoint, FT_LOAD_TARGET_LIGHT);
 	assert(!err);
 
-	TessellationContext tessellation_context = {
-		.lines = (GlyphLine *)malloc(MAX_TOTAL_GLYPH_LINES * sizeof(GlyphLine)),
-		.num_lines = 0
+	err = FT_Outline_Decompose(&freetype_face->glyph->outline, &outline_funcs, context);
+	assert(!err);
+
+	u32 num_lines_in_glyph = context->num_lines - offset;
+	return (GlyphOffset) {
+		.offset = offset,
+		.num_lines = num_lines_in_glyph
 	};
-	GlyphOffset *glyph_offsets = (GlyphOffset *)malloc(NUM_PRINTABLE_CHARS * sizeof(GlyphOffset));
+}
+
+static void tessellate_glyph_batches(void *data) {
+	TessellationWorker *worker = (TessellationWorker *)data;
+	TessellationJob *job = worker->job;
+	worker->context.flattening_tolerance = job->flattening_tolerance;
+	worker->context.rasterizer = job->rasterizer;
+	TRACE_ZONE_BEGIN(zone, "tessellate_glyph_batches");
+
+	// FreeType objects must not be shared between threads, so each worker has its own
+	FT_Library freetype_library;
+	FT_Error err = FT_Init_FreeType(&freetype_library);
+	assert(!err);
+	// tessellate_glyphs already opened the same face, so this cannot fail
+	FT_Face freetype_face = create_font_face(freetype_library, job->font_data, job->font_data_size,
+		job->font_size);
+	assert(freetype_face);
+
+	u32 num_batches = (job->num_glyphs + GLYPHS_PER_TESSELLATION_BATCH - 1) / GLYPHS_PER_TESSELLATION_BATCH;
+	for(;;) {
+		u32 batch = platform_atomic_add_u32(&job->next_batch, 1);
+		if(batch >= num_batches) {
+			break;
+		}
 
-	// For the space character an empty entry is fine
-	glyph_offsets[0] = (GlyphOffset) { 0 };
+		u32 first_glyph = batch * GLYPHS_PER_TESSELLATION_BATCH;
+		u32 end_glyph = MIN(first_glyph + GLYPHS_PER_TESSELLATION_BATCH, job->num_glyphs);
+		for(u32 i = first_glyph; i < end_glyph; ++i) {
+			job->glyph_offsets[i] = tessellate_glyph(freetype_face, job->first_codepoint + i, &worker->context);
+			job->glyph_workers[i] = (u8)worker->index;
+		}
+		sort_glyph_lines(&worker->context, &job->glyph_offsets[first_glyph], end_glyph - first_glyph);
+	}
 
-	for(u32 c = 0x21; c <= 0x7E; ++c) {
-		u32 index = c - 0x20;
+	FT_Done_Face(freetype_face);
+	FT_Done_FreeType(freetype_library);
+	TRACE_ZONE_END(zone);
+}
 
-		u32 offset = tessellation_context.num_lines;
+// Entry of the spawned workers, the first worker runs on the font loader thread and keeps its name
+static void tessellation_worker_main(void *data) {
+	trace_set_thread_name("tessellation worker");
+	tessellate_glyph_batches(data);
+}
 
-		err = FT_Load_Char(freetype_face, c, FT_LOAD_TARGET_LIGHT);
-		assert(!err);
+static void *read_font_file(const char *font_path, FT_Long *size) {
+	FILE *file = fopen(font_path, "rb");
+	if(!file) {
+		printf("Could not open font %s\n", font_path);
+		return NULL;
+	}
 
-		err = FT_Outline_Decompose(&freetype_face->glyph->outline, &outline_funcs, &tessellation_context);
-		assert(!err);
+	fseek(file, 0, SEEK_END);
+	long file_size = ftell(file);
+	rewind(file);
 
-		u32 num_lines_in_glyph = tessellation_context.num_lines - offset;
-		qsort(&tessellation_context.lines[offset], num_lines_in_glyph, sizeof(GlyphLine), cmp_glyph_lines);
+	void *data = malloc(file_size);
+	assert(data);
+	size_t read = fread(data, file_size, 1, file);
+	assert(read == 1);
+	fclose(file);
 
-		glyph_offsets[index] = (GlyphOffset) {
-			.offset = offset,
-			.num_lines = tessellation_context.num_lines - offset
-		};
+	*size = (FT_Long)file_size;
+	return data;
+}
+
+// Tessellates all printable ASCII glyphs on up to one worker per core. The line buffers of
+// the workers are merged in codepoint order afterwards, so the result does not depend on
+// which worker tessellated which glyph. Returns no glyphs if the font cannot be opened.
+static TessellatedGlyphs tessellate_glyphs(const char *font_path, u32 font_size, float flattening_tolerance,
+	GlyphRasterizer rasterizer) {
+	TRACE_ZONE_BEGIN(zone, "tessellate_glyphs");
+	FT_Long font_data_size;
+	FT_Byte *font_data = (FT_Byte *)read_font_file(font_path, &font_data_size);
+	if(!font_data) {
+		TRACE_ZONE_END(zone);
+		return (TessellatedGlyphs) { 0 };
+	}
+
+	// The face is opened here first so an unsupported font is reported before any worker starts,
+	// it also provides the metrics once the glyphs are tessellated
+	FT_Library freetype_library;
+	FT_Error err = FT_Init_FreeType(&freetype_library);
+	assert(!err);
+	FT_Face freetype_face = create_font_face(freetype_library, font_data, font_data_size, font_size);
+	if(!freetype_face) {
+		printf("Could not load font %s, its format is not supported\n", font_path);
+		FT_Done_FreeType(freetype_library);
+		free(font_data);
+		TRACE_ZONE_END(zone);
+		return (TessellatedGlyphs) { 0 };
+	}
+
+	TessellationJob job = {
+		.font_data = font_data,
+		.font_data_size = font_data_size,
+		.font_size = font_size,
+		.flattening_tolerance = flattening_tolerance,
+		.rasterizer = rasterizer,
+		.first_codepoint = FIRST_PRINTABLE_CHAR,
+		.num_glyphs = NUM_PRINTABLE_CHARS,
+		.next_batch = 0,
+		.glyph_offsets = (GlyphOffset *)calloc(NUM_PRINTABLE_CHARS, sizeof(GlyphOffset)),
+		.glyph_workers = (u8 *)calloc(NUM_PRINTABLE_CHARS, sizeof(u8))
+	};
+	assert(job.glyph_offsets && job.glyph_workers);
+
+	u32 num_batches = (job.num_glyphs + GLYPHS_PER_TESSELLATION_BATCH - 1) / GLYPHS_PER_TESSELLATION_BATCH;
+	u32 num_workers = MIN(MIN(platform_get_processor_count(), MAX_TESSELLATION_THREADS), num_batches);
+	num_workers = MAX(num_workers, 1);
+
+	// The calling thread is the first worker
+	TessellationWorker workers[MAX_TESSELLATION_THREADS] = { 0 };
+	for(u32 i = 0; i < num_workers; ++i) {
+		workers[i] = (TessellationWorker) { .job = &job, .index = i };
+	}
+	for(u32 i = 1; i < num_workers; ++i) {
+		workers[i].thread = platform_create_thread(tessellation_worker_main, &workers[i]);
+	}
+	tessellate_glyph_batches(&workers[0]);
+	for(u32 i = 1; i < num_workers; ++i) {
+		platform_join_thread(workers[i].thread);
 	}
 
+	// Merge the line buffers and make the offsets relative to the merged buffer
+	u32 total_lines = 0;
+	for(u32 i = 0; i < num_workers; ++i) {
+		total_lines += workers[i].context.num_lines;
+	}
+	assert(total_lines <= MAX_TOTAL_GLYPH_LINES);
+
+	GlyphLine *lines = (GlyphLine *)malloc(MAX(total_lines, 1) * sizeof(GlyphLine));
+	assert(lines);
+	GlyphPoint *controls = NULL;
+	if(rasterizer == GLYPH_RASTERIZER_CURVES) {
+		controls = (GlyphPoint *)malloc(MAX(total_lines, 1) * sizeof(GlyphPoint));
+		assert(controls);
+	}
+	u32 num_lines = 0;
+	GlyphOffset *glyph_offsets = job.glyph_offsets;
+	for(u32 i = 0; i < job.num_glyphs; ++i) {
+		TessellationContext *context = &workers[job.glyph_workers[i]].context;
+		memcpy(&lines[num_lines], &context->lines[glyph_offsets[i].offset],
+			glyph_offsets[i].num_lines * sizeof(GlyphLine));
+		if(controls) {
+			memcpy(&controls[num_lines], &context->controls[glyph_offsets[i].offset],
+				glyph_offsets[i].num_lines * sizeof(GlyphPoint));
+		}
+		glyph_offsets[i].offset = num_lines;
+		num_lines += glyph_offsets[i].num_lines;
+	}
+	for(u32 i = 0; i < num_workers; ++i) {
+		free(workers[i].context.lines);
+		free(workers[i].context.controls);
+		free(workers[i].context.sort_keys);
+		free(workers[i].context.sort_lines);
+		free(workers[i].context.sort_controls);
+	}
+	free(job.glyph_workers);
+
+	// The font is monospaced, the advance of any glyph is the advance of all of them
+	err = FT_Load_Char(freetype_face, FIRST_PRINTABLE_CHAR + NUM_PRINTABLE_CHARS - 1, FT_LOAD_TARGET_LIGHT);
+	assert(!err);
+
 	float glyph_width = freetype_face->glyph->linearHoriAdvance / 65536.0f;
 	float glyph_height = (float)(freetype_face->size->metrics.height >> 6);
 	float descender = (float)(freetype_face->size->metrics.descender >> 6);
@@ -929,20 +2217,20 @@ static TessellatedGlyphs tessellate_glyphs(const char *font_path, u32 font_size)
 	// Pre-rasterization pass to adjust coordinates to be +Y down
 	// and to find the minimum y coordinate so the glyph atlas can take
 	// an early out in case a pixel is strictly above the glyph outlines.
-	for (u32 c = 0x21; c <= 0x7E; ++c) {
-		u32 index = c - 0x20;
+	for (u32 index = 0; index < job.num_glyphs; ++index) {
 		u32 offset = glyph_offsets[index].offset;
 		float min_y = glyph_height;
 		for (u32 i = 0; i < glyph_offsets[index].num_lines; ++i) {
-			tessellation_context.lines[offset + i].a.y = 
-				glyph_height - (tessellation_context.lines[offset + i].a.y - descender);
-			tessellation_context.lines[offset + i].b.y = 
-				glyph_height - (tessellation_context.lines[offset + i].b.y - descender);
-			if (tessellation_context.lines[offset + i].a.y < min_y) {
-				min_y = tessellation_context.lines[offset + i].a.y;
+			lines[offset + i].a.y = glyph_height - (lines[offset + i].a.y - descender);
+			lines[offset + i].b.y = glyph_height - (lines[offset + i].b.y - descender);
+			if (controls) {
+				controls[offset + i].y = glyph_height - (controls[offset + i].y - descender);
 			}
-			if (tessellation_context.lines[offset + i].b.y < min_y) {
-				min_y = tessellation_context.lines[offset + i].b.y;
+			if (lines[offset + i].a.y < min_y) {
+				min_y = lines[offset + i].a.y;
+			}
+			if (lines[offset + i].b.y < min_y) {
+				min_y = lines[offset + i].b.y;
 			}
 		}
 	}
@@ -954,20 +2242,81 @@ static TessellatedGlyphs tessellate_glyphs(const char *font_path, u32 font_size)
 		.cell_height = (u32)ceil(glyph_height) + 1
 	};
 
+	// Interleaved in the layout of write_texture_atlas_curves.comp
+	GlyphCurve *curves = NULL;
+	if(controls) {
+		curves = (GlyphCurve *)malloc(MAX(num_lines, 1) * sizeof(GlyphCurve));
+		assert(curves);
+		for(u32 i = 0; i < num_lines; ++i) {
+			curves[i] = (GlyphCurve) { lines[i].a, controls[i], lines[i].b };
+		}
+		free(lines);
+		free(controls);
+		lines = NULL;
+	}
+
+	// Memory faces reference the font data until they are destroyed
 	FT_Done_Face(freetype_face);
 	FT_Done_FreeType(freetype_library);
+	free(font_data);
+	TRACE_ZONE_END(zone);
 
 	return (TessellatedGlyphs) {
-		.lines = tessellation_context.lines,
-		.num_lines = tessellation_context.num_lines,
+		.rasterizer = rasterizer,
+		.lines = lines,
+		.curves = curves,
+		.num_lines = num_lines,
 		.glyph_offsets = glyph_offsets,
 		.num_glyphs = NUM_PRINTABLE_CHARS,
 		.metrics = glyph_metrics
 	};
 }
 
+static void load_font(void *data) {
+	FontLoader *loader = (FontLoader *)data;
+	trace_set_thread_name("font loader");
+	loader->tessellated_glyphs = tessellate_glyphs(loader->font_path, loader->font_size,
+		loader->flattening_tolerance, loader->rasterizer);
+	if(loader->tessellated_glyphs.num_glyphs == 0) {
+		printf("Falling back to %s\n", loader->fallback_font_path);
+		loader->tessellated_glyphs = tessellate_glyphs(loader->fallback_font_path, loader->font_size,
+			loader->flattening_tolerance, loader->rasterizer);
+	}
+}
+
+// The loader must stay at the same address until finish_font_loading has returned
+static void start_font_loading(FontLoader *loader, GlyphRasterizer rasterizer) {
+#ifdef _WIN32
+	*loader = (FontLoader) {
+		.font_path = "C:/Windows/Fonts/consola.ttf",
+		.fallback_font_path = "C:/Windows/Fonts/cour.ttf",
+		.font_size = 26
+	};
+#else
+	*loader = (FontLoader) {
+		.font_path = "/usr/share/fonts/truetype/ubuntu/UbuntuMono-R.ttf",
+		.fallback_font_path = "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+		.font_size = 30
+	};
+#endif
+	loader->flattening_tolerance = FLATTENING_TOLERANCE;
+	loader->rasterizer = rasterizer;
+	loader->thread = platform_create_thread(load_font, loader);
+}
+
+static TessellatedGlyphs finish_font_loading(FontLoader *loader) {
+	platform_join_thread(loader->thread);
+	// Without glyph metrics there is nothing the renderer could lay out
+	if(loader->tessellated_glyphs.num_glyphs == 0) {
+		printf("No usable font, tried %s and %s\n", loader->font_path, loader->fallback_font_path);
+		exit(EXIT_FAILURE);
+	}
+	return loader->tessellated_glyphs;
+}
+
 static GlyphResources create_glyph_resources(Window window, VkInstance instance, 
-    PhysicalDevice physical_device, LogicalDevice logical_device) {
+    LogicalDevice logical_device, GpuAllocator *allocator, VkPipelineCache pipeline_cache, VkCommandPool command_pool,
+	QueueTimeline *timeline, RetiredResources *retired, UploadMode upload_mode, FontLoader *font_loader) {
 	VkDescriptorPoolSize pool_sizes[] = {
 		{
 			.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
@@ -1026,31 +2375,9 @@ static GlyphResources create_glyph_resources(Window window, VkInstance instance,
 	VkDescriptorSet descriptor_set;
 	VK_CHECK(vkAllocateDescriptorSets(logical_device.handle, &descriptor_set_allocate_info, &descriptor_set));
 
-	Image glyph_atlas = create_image_2d(logical_device.handle, physical_device.memory_properties,
-		GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, VK_FORMAT_R16_UINT);
-
-#ifdef _WIN32
-	TessellatedGlyphs tessellated_glyphs = tessellate_glyphs("C:/Windows/Fonts/consola.ttf", 26);
-#else
-	TessellatedGlyphs tessellated_glyphs = tessellate_glyphs("/usr/share/fonts/truetype/ubuntu/UbuntuMono-R.ttf", 30);
-#endif
-
-	u32 chars_per_row = (u32)(GLYPH_ATLAS_SIZE / tessellated_glyphs.metrics.glyph_width);
-	u32 chars_per_col = (u32)(GLYPH_ATLAS_SIZE / tessellated_glyphs.metrics.glyph_height);
-	assert(chars_per_row * chars_per_col >= NUM_PRINTABLE_CHARS);
-
-	MappedBuffer glyph_lines_buffer = create_mapped_buffer(logical_device.handle,
-		physical_device.memory_properties,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		tessellated_glyphs.num_lines * sizeof(GlyphLine));
-	memcpy(glyph_lines_buffer.data, tessellated_glyphs.lines, tessellated_glyphs.num_lines * sizeof(GlyphLine));
-	free(tessellated_glyphs.lines);
-	MappedBuffer glyph_offsets_buffer = create_mapped_buffer(logical_device.handle,
-		physical_device.memory_properties,
-		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-		tessellated_glyphs.num_glyphs * sizeof(GlyphOffset));
-	memcpy(glyph_offsets_buffer.data, tessellated_glyphs.glyph_offsets, tessellated_glyphs.num_glyphs * sizeof(GlyphOffset));
-	free(tessellated_glyphs.glyph_offsets);
+	Image glyph_atlas = create_image_2d(allocator,
+		GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, VK_FORMAT_R16_UINT,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 
 	VkPipelineLayoutCreateInfo layout_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -1069,7 +2396,9 @@ static GlyphResources create_glyph_resources(Window window, VkInstance instance,
 	VkPipelineShaderStageCreateInfo shader_stage_info = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 		.stage = VK_SHADER_STAGE_COMPUTE_BIT,
-		.module = create_shader_module(logical_device.handle, SHADER_TYPE_COMPUTE, "write_texture_atlas.comp"),
+		.module = create_shader_module(logical_device.handle, SHADER_TYPE_COMPUTE,
+			font_loader->rasterizer == GLYPH_RASTERIZER_CURVES ?
+				"write_texture_atlas_curves.comp" : "write_texture_atlas.comp"),
 		.pName = "main"
 	};
 
@@ -1079,10 +2408,37 @@ static GlyphResources create_glyph_resources(Window window, VkInstance instance,
 		.layout = pipeline_layout
 	};
 	VkPipeline pipeline;
-	vkCreateComputePipelines(logical_device.handle, NULL, 1, &compute_pipeline_info, NULL, &pipeline);
+	VK_CHECK(vkCreateComputePipelines(logical_device.handle, pipeline_cache, 1, &compute_pipeline_info, NULL,
+		&pipeline));
 
 	vkDestroyShaderModule(logical_device.handle, shader_stage_info.module, NULL);
 
+	// Everything above is independent of the font, only now the tessellation has to be done
+	TessellatedGlyphs tessellated_glyphs = finish_font_loading(font_loader);
+
+	u32 chars_per_row = (u32)(GLYPH_ATLAS_SIZE / tessellated_glyphs.metrics.glyph_width);
+	u32 chars_per_col = (u32)(GLYPH_ATLAS_SIZE / tessellated_glyphs.metrics.glyph_height);
+	assert(chars_per_row * chars_per_col >= NUM_PRINTABLE_CHARS);
+
+	// Must match the cell layout of write_texture_atlas.comp
+	GlyphCellTable cell_table = glyph_cell_table_create(GLYPH_ATLAS_SIZE / tessellated_glyphs.metrics.cell_width);
+
+	// Both shaders read their primitives from binding 1, so only the buffer contents differ
+	bool curves = tessellated_glyphs.rasterizer == GLYPH_RASTERIZER_CURVES;
+	Buffer glyph_lines_buffer = create_buffer_with_data(logical_device, allocator,
+		command_pool, timeline, retired, upload_mode,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		curves ? (void *)tessellated_glyphs.curves : (void *)tessellated_glyphs.lines,
+		tessellated_glyphs.num_lines * (curves ? sizeof(GlyphCurve) : sizeof(GlyphLine)));
+	free(tessellated_glyphs.lines);
+	free(tessellated_glyphs.curves);
+	Buffer glyph_offsets_buffer = create_buffer_with_data(logical_device, allocator,
+		command_pool, timeline, retired, upload_mode,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		tessellated_glyphs.glyph_offsets,
+		tessellated_glyphs.num_glyphs * sizeof(GlyphOffset));
+	free(tessellated_glyphs.glyph_offsets);
+
 	return (GlyphResources) {
 		.descriptor_set = {
 			.handle = descriptor_set,
@@ -1096,6 +2452,7 @@ static GlyphResources create_glyph_resources(Window window, VkInstance instance,
 		.glyph_atlas = {
 			.atlas = glyph_atlas,
 			.metrics = tessellated_glyphs.metrics,
+			.cell_table = cell_table,
 			.lines_buffer = glyph_lines_buffer,
 			.offsets_buffer = glyph_offsets_buffer
 		}
@@ -1217,8 +2574,15 @@ static void write_descriptors(LogicalDevice logical_device, GlyphResources *glyp
 	vkUpdateDescriptorSets(logical_device.handle, 1, &write_descriptor_set, 0, NULL);
 }
 
-static void rasterize_glyphs(LogicalDevice logical_device, GlyphResources *glyph_resources, VkCommandPool command_pool) {
-	VkCommandBuffer command_buffer = start_one_time_command_buffer(logical_device, command_pool);
+// Rasterizes the atlas on the compute queue, the graphics queue keeps running meanwhile. Ownership
+// of the atlas is then handed to the graphics family by a graphics submission that waits for the
+// compute timeline on the GPU, frames wait for that submission through the graphics timeline.
+static void rasterize_glyphs(LogicalDevice logical_device, PhysicalDevice physical_device,
+	GlyphResources *glyph_resources, VkCommandPool compute_command_pool, QueueTimeline *compute_timeline,
+	RetiredResources *compute_retired, VkCommandPool graphics_command_pool, QueueTimeline *graphics_timeline,
+	RetiredResources *graphics_retired, GpuProfiler *gpu_profiler) {
+	TRACE_ZONE_BEGIN(zone, "rasterize_glyphs");
+	VkCommandBuffer command_buffer = start_one_time_command_buffer(logical_device, compute_command_pool);
 
 	transition_glyph_image(logical_device, command_buffer, glyph_resources->glyph_atlas.atlas);
 
@@ -1235,62 +2599,151 @@ static void rasterize_glyphs(LogicalDevice logical_device, GlyphResources *glyph
 
 	vkCmdPushConstants(command_buffer, glyph_resources->pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
 		sizeof(GlyphPushConstants), &push_constants);
+	gpu_query_begin(&gpu_profiler->glyph_queries, command_buffer, 0);
 	vkCmdDispatch(command_buffer, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, 1);
-
-	end_one_time_command_buffer(logical_device, command_buffer, command_pool);
+	gpu_query_end(&gpu_profiler->glyph_queries, command_buffer, 0);
+
+	Image atlas = glyph_resources->glyph_atlas.atlas;
+	record_glyph_atlas_ownership_barrier(command_buffer, atlas, physical_device,
+		VK_ACCESS_SHADER_WRITE_BIT, 0,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	u64 rasterized_value = submit_one_time_command_buffer(command_buffer, compute_timeline, compute_retired,
+		NULL, 0);
+	gpu_query_submitted(&gpu_profiler->glyph_queries, 0);
+
+	VkCommandBuffer acquire_command_buffer = start_one_time_command_buffer(logical_device, graphics_command_pool);
+	record_glyph_atlas_ownership_barrier(acquire_command_buffer, atlas, physical_device,
+		0, VK_ACCESS_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	SubmitWait rasterized_wait = {
+		.semaphore = compute_timeline->semaphore,
+		.value = rasterized_value,
+		.stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+	};
+	submit_one_time_command_buffer(acquire_command_buffer, graphics_timeline, graphics_retired,
+		&rasterized_wait, 1);
+	TRACE_ZONE_END(zone);
 }
 
-static Renderer renderer_initialize(Window window) {
-	VkInstance instance = create_instance();
-	VkSurfaceKHR surface = create_surface(instance, window);
+// The window is ignored when rendering headless, the offscreen images are sized to headless_extent instead
+static Renderer create_renderer(Window window, bool headless, VkExtent2D headless_extent,
+	VkPresentModeKHR preferred_present_mode, const char *device_override, GlyphRasterizer glyph_rasterizer) {
+	FontLoader font_loader;
+	start_font_loading(&font_loader, glyph_rasterizer);
+
+	VkInstance instance = create_instance(headless);
+	VkSurfaceKHR surface = headless ? VK_NULL_HANDLE : create_surface(instance, window);
 
 #ifndef NDEBUG
 	VkDebugUtilsMessengerEXT debug_messenger = create_debug_messenger(instance);
 #endif
 
-	PhysicalDevice physical_device = create_physical_device(instance, surface);
-	LogicalDevice logical_device = create_logical_device(physical_device);
-	Swapchain swapchain = create_swapchain(window, surface, physical_device, logical_device, NULL);
-	VkCommandPool command_pool = create_command_pool(physical_device, logical_device);
+	PhysicalDevice physical_device = create_physical_device(instance, surface, device_override);
+	LogicalDevice logical_device = create_logical_device(physical_device, headless);
+	GpuAllocator allocator = gpu_allocator_create(logical_device.handle, physical_device.memory_properties,
+		physical_device.properties.properties.limits.bufferImageGranularity);
+	GpuProfiler gpu_profiler = gpu_profiler_create(logical_device.handle,
+		physical_device.properties.properties.limits.timestampPeriod, physical_device.graphics_timestamp_valid_bits,
+		physical_device.compute_timestamp_valid_bits, physical_device.has_pipeline_statistics);
+	Swapchain swapchain = headless ?
+		create_offscreen_swapchain(&allocator, headless_extent) :
+		create_swapchain(window, surface, physical_device, logical_device, preferred_present_mode, NULL);
+	VkCommandPool command_pool = create_command_pool(logical_device, physical_device.graphics_family_idx);
+	QueueTimeline graphics_timeline = create_queue_timeline(logical_device.handle, logical_device.graphics_queue);
+	RetiredResources retired_resources = { 0 };
+	VkCommandPool compute_command_pool = create_command_pool(logical_device, physical_device.compute_family_idx);
+	QueueTimeline compute_timeline = create_queue_timeline(logical_device.handle, logical_device.compute_queue);
+	RetiredResources compute_retired_resources = { 0 };
 	VkSampler texture_sampler = create_texture_sampler(logical_device);
-	VkRenderPass render_pass = create_render_pass(logical_device, swapchain);
+	VkRenderPass render_pass = create_render_pass(logical_device, swapchain,
+		headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+	create_swapchain_image_resources(logical_device, render_pass, command_pool, &gpu_profiler, &swapchain);
 	DescriptorSet descriptor_set = create_descriptor_set(logical_device);
-	Pipeline graphics_pipeline = create_rasterization_pipeline(instance, logical_device, swapchain,
+	char pipeline_cache_path[FILENAME_MAX];
+	get_pipeline_cache_path(pipeline_cache_path, sizeof(pipeline_cache_path));
+	VkPipelineCache pipeline_cache = create_pipeline_cache(physical_device, logical_device, pipeline_cache_path);
+	Pipeline graphics_pipeline = create_rasterization_pipeline(instance, logical_device, pipeline_cache,
 		render_pass, descriptor_set);
-	GlyphResources glyph_resources = create_glyph_resources(window, instance, physical_device, logical_device);
+	UploadMode upload_mode = physical_device.has_unified_memory ? UPLOAD_MODE_MAPPED_DIRECT : UPLOAD_MODE_STAGING;
+	// The glyph buffers are only read by the rasterization on the compute queue, so they are uploaded there
+	GlyphResources glyph_resources = create_glyph_resources(window, instance, logical_device, &allocator,
+		pipeline_cache, compute_command_pool, &compute_timeline, &compute_retired_resources, upload_mode,
+		&font_loader);
 
 	write_descriptors(logical_device, &glyph_resources, descriptor_set, texture_sampler);
-	rasterize_glyphs(logical_device, &glyph_resources, command_pool);
+	rasterize_glyphs(logical_device, physical_device, &glyph_resources, compute_command_pool, &compute_timeline,
+		&compute_retired_resources, command_pool, &graphics_timeline, &retired_resources, &gpu_profiler);
+
+	u64 vertex_ring_capacity = get_vertex_ring_capacity_for_extent(swapchain.extent,
+		glyph_resources.glyph_atlas.metrics);
+	VertexRing vertex_ring = create_vertex_ring(&allocator, upload_mode, vertex_ring_capacity,
+		vertex_ring_capacity);
 
-	MappedBuffer vertex_buffer = create_mapped_buffer(logical_device.handle,
-		physical_device.memory_properties,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		sizeof(Vertex) * 1024 * 1024 * 64);
+	// Immediate presentation is meant for benchmarks, those frames are never paced and neither are headless ones
+	u64 refresh_period_ns = swapchain.present_mode == VK_PRESENT_MODE_IMMEDIATE_KHR ? 0 :
+		get_display_refresh_period_ns(window);
 
 	Renderer renderer = {
 		.window = window,
+		.headless = headless,
 		.instance = instance,
 		.surface = surface,
 		.logical_device = logical_device,
 		.physical_device = physical_device,
+		.allocator = allocator,
+		.gpu_profiler = gpu_profiler,
 		.swapchain = swapchain,
+		.preferred_present_mode = preferred_present_mode,
+		.frame_pacer = create_frame_pacer(refresh_period_ns),
 		.command_pool = command_pool,
+		.graphics_timeline = graphics_timeline,
+		.upload_timeline_value = graphics_timeline.submitted_value,
+		.retired_resources = retired_resources,
+		.compute_command_pool = compute_command_pool,
+		.compute_timeline = compute_timeline,
+		.compute_retired_resources = compute_retired_resources,
 		.descriptor_set = descriptor_set,
 		.texture_sampler = texture_sampler,
 		.render_pass = render_pass,
+		.pipeline_cache = pipeline_cache,
 		.graphics_pipeline = graphics_pipeline,
-		.vertex_buffer = vertex_buffer,
-		.active_vertex_count = 0,
+		.upload_mode = upload_mode,
+		.vertex_ring = vertex_ring,
+		.frame_index = 0,
+		.presented_image_index = 0,
+		.text_instance_cache = { 0 },
+		.number_instance_cache = { 0 },
+		.first_line = 0,
+		.lines_on_screen = get_lines_on_screen(swapchain.extent, glyph_resources.glyph_atlas.metrics),
+		.draw_generation = 1,
+		.drawn_block_keys = NULL,
+		.num_drawn_block_keys = 0,
+		.drawn_block_keys_capacity = 0,
+		.vertex_region_slot = 0,
+		.vertex_upload_pending = false,
 		.glyph_resources = glyph_resources,
 #ifndef NDEBUG
 		.debug_messenger = debug_messenger
 #endif
 	};
+	strcpy(renderer.pipeline_cache_path, pipeline_cache_path);
 
 	initialize_frame_resources(&renderer);
 	return renderer;
 }
 
+static Renderer renderer_initialize(Window window, VkPresentModeKHR preferred_present_mode,
+	const char *device_override, GlyphRasterizer glyph_rasterizer) {
+	return create_renderer(window, false, (VkExtent2D) { 0 }, preferred_present_mode, device_override,
+		glyph_rasterizer);
+}
+
+static Renderer renderer_initialize_headless(u32 width, u32 height, const char *device_override,
+	GlyphRasterizer glyph_rasterizer) {
+	return create_renderer((Window) { 0 }, true, (VkExtent2D) { width, height }, VK_PRESENT_MODE_IMMEDIATE_KHR,
+		device_override, glyph_rasterizer);
+}
+
 
 static void renderer_destroy(Renderer *renderer) {
 	VkDevice device = renderer->logical_device.handle;
@@ -1300,16 +2753,19 @@ static void renderer_destroy(Renderer *renderer) {
 	for(u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
 		vkDestroySemaphore(device, renderer->image_available_semaphores[i], NULL);
 		vkDestroySemaphore(device, renderer->render_finished_semaphores[i], NULL);
-		vkDestroyFence(device, renderer->fences[i], NULL);
-		vkDestroyFramebuffer(device, renderer->framebuffers[i], NULL);
 	}
 
-	for(u32 i = 0; i < renderer->swapchain.image_count; ++i) {
-		vkDestroyImageView(device, renderer->swapchain.image_views[i], NULL);
-	}
-	vkDestroySwapchainKHR(device, renderer->swapchain.handle, NULL);
-	free(renderer->swapchain.images);
-	free(renderer->swapchain.image_views);
+	destroy_retired_resources(device, &renderer->allocator, renderer->command_pool, &renderer->retired_resources, UINT64_MAX);
+	free(renderer->retired_resources.resources);
+	vkDestroySemaphore(device, renderer->graphics_timeline.semaphore, NULL);
+	destroy_retired_resources(device, &renderer->allocator, renderer->compute_command_pool, &renderer->compute_retired_resources,
+		UINT64_MAX);
+	free(renderer->compute_retired_resources.resources);
+	vkDestroySemaphore(device, renderer->compute_timeline.semaphore, NULL);
+	vkDestroyCommandPool(device, renderer->compute_command_pool, NULL);
+
+	destroy_swapchain(device, &renderer->allocator, renderer->command_pool, &renderer->swapchain);
+	free(renderer->drawn_block_keys);
 
 	vkDestroyCommandPool(device, renderer->command_pool, NULL);
 
@@ -1320,129 +2776,349 @@ static void renderer_destroy(Renderer *renderer) {
 	vkDestroyRenderPass(device, renderer->render_pass, NULL);
 	vkDestroyPipelineLayout(device, renderer->graphics_pipeline.layout, NULL);
 	vkDestroyPipeline(device, renderer->graphics_pipeline.handle, NULL);
-	vkDestroyBuffer(device, renderer->vertex_buffer.handle, NULL);
-	vkFreeMemory(device, renderer->vertex_buffer.memory, NULL);
+	destroy_vertex_ring(device, &renderer->allocator, &renderer->vertex_ring);
+	destroy_glyph_instance_cache(&renderer->text_instance_cache);
+	destroy_glyph_instance_cache(&renderer->number_instance_cache);
 
 	// Destroy Vulkan glyph resources
 	vkDestroyDescriptorSetLayout(device, renderer->glyph_resources.descriptor_set.layout, NULL);
 	vkDestroyDescriptorPool(device, renderer->glyph_resources.descriptor_set.pool, NULL);
 	vkDestroyImageView(device, renderer->glyph_resources.glyph_atlas.atlas.view, NULL);
 	vkDestroyImage(device, renderer->glyph_resources.glyph_atlas.atlas.handle, NULL);
-	vkFreeMemory(device, renderer->glyph_resources.glyph_atlas.atlas.memory, NULL);
+	gpu_free(&renderer->allocator, &renderer->glyph_resources.glyph_atlas.atlas.allocation);
 	vkDestroyBuffer(device, renderer->glyph_resources.glyph_atlas.lines_buffer.handle, NULL);
-	vkFreeMemory(device, renderer->glyph_resources.glyph_atlas.lines_buffer.memory, NULL);
+	gpu_free(&renderer->allocator, &renderer->glyph_resources.glyph_atlas.lines_buffer.allocation);
 	vkDestroyBuffer(device, renderer->glyph_resources.glyph_atlas.offsets_buffer.handle, NULL);
-	vkFreeMemory(device, renderer->glyph_resources.glyph_atlas.offsets_buffer.memory, NULL);
+	gpu_free(&renderer->allocator, &renderer->glyph_resources.glyph_atlas.offsets_buffer.allocation);
 	vkDestroyPipelineLayout(device, renderer->glyph_resources.pipeline.layout, NULL);
 	vkDestroyPipeline(device, renderer->glyph_resources.pipeline.handle, NULL);
 
+	save_pipeline_cache(device, renderer->pipeline_cache, renderer->pipeline_cache_path);
+	vkDestroyPipelineCache(device, renderer->pipeline_cache, NULL);
+
+	gpu_profiler_destroy(&renderer->gpu_profiler);
+	gpu_allocator_destroy(&renderer->allocator);
 	vkDestroyDevice(device, NULL);
 
 #ifndef NDEBUG
 	((PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(renderer->instance,
 		"vkDestroyDebugUtilsMessengerEXT"))(renderer->instance, renderer->debug_messenger, NULL);
 #endif
-	vkDestroySurfaceKHR(renderer->instance, renderer->surface, NULL);
+	if(!renderer->headless) {
+		vkDestroySurfaceKHR(renderer->instance, renderer->surface, NULL);
+	}
 	vkDestroyInstance(renderer->instance, NULL);
 }
 
+// Frames in flight may still render to the old swapchain images, so the old swapchain
+// is only destroyed once the timeline has passed the last value submitted before the resize.
 static void renderer_resize(Renderer *renderer) {
+	Swapchain old_swapchain = renderer->swapchain;
 	renderer->swapchain = create_swapchain(renderer->window, renderer->surface, renderer->physical_device,
-		renderer->logical_device, &renderer->swapchain);
+		renderer->logical_device, renderer->preferred_present_mode, &old_swapchain);
+	retire_resource(&renderer->retired_resources, (RetiredResource) {
+		.type = RETIRED_RESOURCE_SWAPCHAIN,
+		.timeline_value = renderer->graphics_timeline.submitted_value,
+		.swapchain = old_swapchain
+	});
+	create_swapchain_image_resources(renderer->logical_device, renderer->render_pass, renderer->command_pool,
+		&renderer->gpu_profiler, &renderer->swapchain);
+
+	// The vertex ring itself is grown on demand and shrunk lazily, only the lower bound changes here
+	renderer->vertex_ring.min_capacity = get_vertex_ring_capacity_for_extent(renderer->swapchain.extent,
+		renderer->glyph_resources.glyph_atlas.metrics);
+
+	platform_atomic_store_u32(&renderer->lines_on_screen, get_lines_on_screen(renderer->swapchain.extent,
+		renderer->glyph_resources.glyph_atlas.metrics));
 }
 
-// Note: this function frees the draw commands once they have been processed!
-static void renderer_update_draw_lists(Renderer *renderer, DrawList *draw_lists, u32 num_draw_lists) {
-	renderer->active_vertex_count = 0;
+static u32 count_digits(u32 number) {
+	u32 digits = 0;
+	do {
+		number /= 10;
+		++digits;
+	} while(number > 0);
+	return digits;
+}
+
+// Waits until the GPU is done with the resources of the current frame slot
+// and hands its region of the vertex ring back.
+static void wait_for_frame_resources(Renderer *renderer) {
+	VkDevice device = renderer->logical_device.handle;
+	u32 frame_index = renderer->frame_index;
+	queue_timeline_wait(&renderer->graphics_timeline, renderer->frame_timeline_values[frame_index]);
+	vertex_ring_retire(&renderer->vertex_ring, frame_index);
+
+	// Anything retired at or below the completed value is no longer referenced by the GPU
+	destroy_retired_resources(device, &renderer->allocator, renderer->command_pool, &renderer->retired_resources,
+		queue_timeline_poll(&renderer->graphics_timeline));
+	destroy_retired_resources(device, &renderer->allocator, renderer->compute_command_pool, &renderer->compute_retired_resources,
+		queue_timeline_poll(&renderer->compute_timeline));
+}
+
+// Replaces the vertex ring with a new buffer, the old buffer stays alive until
+// the frames in flight that may still read from it have completed.
+static void resize_vertex_ring(Renderer *renderer, u64 capacity) {
+	VertexRing *ring = &renderer->vertex_ring;
+	retire_resource(&renderer->retired_resources, (RetiredResource) {
+		.type = RETIRED_RESOURCE_VERTEX_RING,
+		.timeline_value = renderer->graphics_timeline.submitted_value,
+		.vertex_ring = *ring
+	});
+
+	*ring = create_vertex_ring(&renderer->allocator,
+		renderer->upload_mode, capacity, ring->min_capacity);
+}
 
-	Vertex *vertex_data = (Vertex *)renderer->vertex_buffer.data;
+static void reserve_vertex_ring(Renderer *renderer, u64 instance_count) {
+	VertexRing *ring = &renderer->vertex_ring;
 
-	u32 glyphs_per_row = GLYPH_ATLAS_SIZE / renderer->glyph_resources.glyph_atlas.metrics.cell_width;
+	if(!vertex_ring_fits(ring, instance_count)) {
+		u64 capacity = MAX(ring->capacity, ring->min_capacity);
+		while(capacity < instance_count * MAX_FRAMES_IN_FLIGHT) {
+			capacity *= 2;
+		}
+		// A new buffer has to be at least twice the size, otherwise the
+		// frames still in flight are what is blocking the allocation
+		resize_vertex_ring(renderer, MAX(capacity, ring->capacity * 2));
+		return;
+	}
+
+	// Shrink geometrically when the largest frame over a longer period
+	// would have fit into a quarter of the buffer
+	if(++ring->frames_since_shrink_check >= VERTEX_RING_SHRINK_CHECK_FRAMES) {
+		u64 peak_count = MAX(ring->peak_count, instance_count);
+		ring->frames_since_shrink_check = 0;
+		ring->peak_count = 0;
+
+		if(peak_count * MAX_FRAMES_IN_FLIGHT * 4 <= ring->capacity &&
+			ring->capacity / 2 >= ring->min_capacity) {
+			resize_vertex_ring(renderer, ring->capacity / 2);
+		}
+	}
+}
+
+// Records which block every command draws, returns whether the sequence differs from the last frame
+static bool update_drawn_block_keys(Renderer *renderer, DrawList *draw_lists, u32 num_draw_lists) {
+	u32 num_keys = 0;
 	for(u32 i = 0; i < num_draw_lists; ++i) {
-		DrawList draw_list = draw_lists[i];
-		for(u32 j = 0; j < draw_list.num_commands; ++j) {
-			DrawCommand command = draw_list.commands[j];
+		num_keys += draw_lists[i].num_commands;
+	}
+	if(num_keys > renderer->drawn_block_keys_capacity) {
+		renderer->drawn_block_keys_capacity = MAX(num_keys, renderer->drawn_block_keys_capacity * 2);
+		renderer->drawn_block_keys = realloc(renderer->drawn_block_keys,
+			renderer->drawn_block_keys_capacity * sizeof(u32));
+		assert(renderer->drawn_block_keys);
+	}
+
+	bool changed = num_keys != renderer->num_drawn_block_keys;
+	u32 key_index = 0;
+	for(u32 i = 0; i < num_draw_lists; ++i) {
+		for(u32 j = 0; j < draw_lists[i].num_commands; ++j) {
+			DrawCommand command = draw_lists[i].commands[j];
+			u32 key = UINT32_MAX;
 			if(command.type == DRAW_COMMAND_TEXT) {
-				for(u32 k = 0; k < command.text.length; ++k) {
-					u32 glyph_index = (u32)command.text.content[k] - 0x20;
-					for(int h = 0; h < 6; ++h) {
-						vertex_data[renderer->active_vertex_count++] = (Vertex) {
-							.pos = h,
-							.uv = h,
-							.glyph_offset_x = glyph_index % glyphs_per_row,
-							.glyph_offset_y = glyph_index / glyphs_per_row,
-							.cell_offset_x = command.text.column + k,
-							.cell_offset_y = command.text.row
-						};
-					}
-				}
+				key = command.text.line << 1;
 			}
 			else if(command.type == DRAW_COMMAND_NUMBER) {
-				u32 number = command.number.num;
+				key = (command.number.line << 1) | 1;
+			}
 
-				u32 digits_in_number = (u32)log10(number) + 1;
-				u32 k = 1;
-				do {
-					u32 glyph_index = 0x30 + (number % 10) - 0x20;
-					for(int h = 0; h < 6; ++h) {
-						vertex_data[renderer->active_vertex_count++] = (Vertex) {
-							.pos = h,
-							.uv = h,
-							.glyph_offset_x = glyph_index % glyphs_per_row,
-							.glyph_offset_y = glyph_index / glyphs_per_row,
-							.cell_offset_x = command.number.column + (digits_in_number - k),
-							.cell_offset_y = command.number.row
-						};
-					}
+			changed |= key_index >= renderer->num_drawn_block_keys || renderer->drawn_block_keys[key_index] != key;
+			renderer->drawn_block_keys[key_index++] = key;
+		}
+	}
+	renderer->num_drawn_block_keys = num_keys;
+	return changed;
+}
 
+static void renderer_update_draw_lists(Renderer *renderer, DrawList *draw_lists, u32 num_draw_lists) {
+	wait_for_frame_resources(renderer);
+	TRACE_ZONE_BEGIN(zone, "pack_vertices");
+
+	// Bring the cached blocks of all visible lines up to date, unchanged lines are not touched
+	const GlyphCellTable *cell_table = &renderer->glyph_resources.glyph_atlas.cell_table;
+	u64 instance_count = 0;
+	u32 first_line = renderer->first_line;
+	bool has_first_line = false;
+	bool blocks_changed = false;
+	for(u32 i = 0; i < num_draw_lists; ++i) {
+		for(u32 j = 0; j < draw_lists[i].num_commands; ++j) {
+			DrawCommand command = draw_lists[i].commands[j];
+			u32 line;
+			u32 row;
+			GlyphInstanceBlock *block;
+			if(command.type == DRAW_COMMAND_TEXT) {
+				line = command.text.line;
+				row = command.text.row;
+				block = get_glyph_instance_block(&renderer->text_instance_cache, line);
+				blocks_changed |= update_glyph_instance_block(block, cell_table, command.text.content,
+					command.text.length, command.text.version, command.text.column, line);
+			}
+			else if(command.type == DRAW_COMMAND_NUMBER) {
+				char digits[10];
+				u32 number = command.number.num;
+				u32 digits_in_number = count_digits(number);
+				for(u32 k = digits_in_number; k > 0; --k) {
+					digits[k - 1] = (char)('0' + number % 10);
 					number /= 10;
-					++k;
-				} while(number > 0);
+				}
+
+				// The number itself identifies the content of the block
+				line = command.number.line;
+				row = command.number.row;
+				block = get_glyph_instance_block(&renderer->number_instance_cache, line);
+				blocks_changed |= update_glyph_instance_block(block, cell_table, digits, digits_in_number,
+					command.number.num, command.number.column, line);
+			}
+			else {
+				continue;
 			}
-		}
 
-		free(draw_list.commands);
+			// All commands of a frame have to agree on the line shown in the first row
+			assert(!has_first_line || first_line == ((line - row) & 0xFFFF));
+			first_line = (line - row) & 0xFFFF;
+			has_first_line = true;
+			instance_count += block->count;
+		}
 	}
-}
+	blocks_changed |= update_drawn_block_keys(renderer, draw_lists, num_draw_lists);
+
+	// Nothing to upload or re-record when the frame draws exactly what the last one did,
+	// the last region is kept alive for this frame instead
+	if(!blocks_changed && first_line == renderer->first_line) {
+		vertex_ring_move_region(&renderer->vertex_ring, renderer->vertex_region_slot, renderer->frame_index);
+		renderer->vertex_region_slot = renderer->frame_index;
+		TRACE_ZONE_END(zone);
+		return;
+	}
+	renderer->first_line = first_line;
+	renderer->draw_generation++;
 
-static void renderer_present(Renderer *renderer) {
-	static u32 resource_index = 0;
+	// Assembling the frame is only copying the blocks
+	reserve_vertex_ring(renderer, instance_count);
+	u64 first_instance = vertex_ring_allocate(&renderer->vertex_ring, renderer->frame_index, instance_count);
+	GlyphInstance *instance_data = (GlyphInstance *)renderer->vertex_ring.buffer.data + first_instance;
+	u64 active_instance_count = 0;
+	renderer->vertex_region_slot = renderer->frame_index;
+	renderer->vertex_upload_pending = true;
 
-	VK_CHECK(vkWaitForFences(renderer->logical_device.handle, 1, &renderer->fences[resource_index], VK_TRUE, UINT64_MAX));
-	VK_CHECK(vkResetFences(renderer->logical_device.handle, 1, &renderer->fences[resource_index]));
+	for(u32 i = 0; i < num_draw_lists; ++i) {
+		DrawList draw_list = draw_lists[i];
+		for(u32 j = 0; j < draw_list.num_commands; ++j) {
+			DrawCommand command = draw_list.commands[j];
+			GlyphInstanceBlock *block;
+			if(command.type == DRAW_COMMAND_TEXT) {
+				block = &renderer->text_instance_cache.blocks[command.text.line];
+			}
+			else if(command.type == DRAW_COMMAND_NUMBER) {
+				block = &renderer->number_instance_cache.blocks[command.number.line];
+			}
+			else {
+				continue;
+			}
 
-	u32 image_index;
-	VkResult result = vkAcquireNextImageKHR(renderer->logical_device.handle, renderer->swapchain.handle, 
-		UINT64_MAX, renderer->image_available_semaphores[resource_index], VK_NULL_HANDLE,
-		&image_index);
-	if(result == VK_ERROR_OUT_OF_DATE_KHR) {
-		renderer_resize(renderer);
-		return;
+			memcpy(&instance_data[active_instance_count], block->instances, block->count * sizeof(GlyphInstance));
+			active_instance_count += block->count;
+		}
 	}
-	VK_CHECK(result);
+	assert(active_instance_count == instance_count);
+	TRACE_ZONE_END(zone);
+}
 
+// Copies the vertex region written this frame into the device-local vertex buffer
+static void record_vertex_upload(Renderer *renderer, VkCommandBuffer command_buffer, VertexRegion vertex_region) {
 	VkCommandBufferBeginInfo command_buffer_begin_info = {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
 	};
-	VK_CHECK(vkBeginCommandBuffer(renderer->command_buffers[resource_index], &command_buffer_begin_info));
+	VK_CHECK(vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info));
 
-	if(renderer->framebuffers[resource_index] != VK_NULL_HANDLE) {
-		vkDestroyFramebuffer(renderer->logical_device.handle, renderer->framebuffers[resource_index], NULL);
-		renderer->framebuffers[resource_index] = VK_NULL_HANDLE;
-	}
+	// The region is copied to the same offset, regions of frames in flight never overlap
+	VkBufferCopy vertex_copy = {
+		.srcOffset = vertex_region.offset * sizeof(GlyphInstance),
+		.dstOffset = vertex_region.offset * sizeof(GlyphInstance),
+		.size = vertex_region.count * sizeof(GlyphInstance)
+	};
+	vkCmdCopyBuffer(command_buffer, renderer->vertex_ring.buffer.handle,
+		renderer->vertex_ring.device_buffer.handle, 1, &vertex_copy);
+
+	// Barriers apply in submission order, so this also covers the draw in the next command buffer
+	VkBufferMemoryBarrier vertex_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = renderer->vertex_ring.device_buffer.handle,
+		.offset = vertex_copy.dstOffset,
+		.size = vertex_copy.size
+	};
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, NULL, 1, &vertex_barrier, 0, NULL);
 
-	VkFramebufferCreateInfo framebuffer_info = {
-		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-		.renderPass = renderer->render_pass,
-		.attachmentCount = 1,
-		.pAttachments = &renderer->swapchain.image_views[image_index],
-		.width = renderer->swapchain.extent.width,
-		.height = renderer->swapchain.extent.height,
-		.layers = 1
+	VK_CHECK(vkEndCommandBuffer(command_buffer));
+}
+
+// The render pass leaves offscreen images in the transfer source layout
+static void record_readback(VkCommandBuffer command_buffer, Swapchain *swapchain, u32 image_index) {
+	VkImageMemoryBarrier image_barrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = swapchain->images[image_index],
+		.subresourceRange = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.levelCount = 1,
+			.layerCount = 1
+		}
 	};
-	VK_CHECK(vkCreateFramebuffer(renderer->logical_device.handle, &framebuffer_info,
-		NULL, &renderer->framebuffers[resource_index]));
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &image_barrier);
+
+	// Rows are tightly packed, a buffer row length of zero means the width of the image
+	VkBufferImageCopy image_copy = {
+		.imageSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.layerCount = 1
+		},
+		.imageExtent = {
+			.width = swapchain->extent.width,
+			.height = swapchain->extent.height,
+			.depth = 1
+		}
+	};
+	vkCmdCopyImageToBuffer(command_buffer, swapchain->images[image_index], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		swapchain->readback_buffers[image_index].handle, 1, &image_copy);
+
+	VkBufferMemoryBarrier buffer_barrier = {
+		.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.buffer = swapchain->readback_buffers[image_index].handle,
+		.size = VK_WHOLE_SIZE
+	};
+	vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1, &buffer_barrier, 0, NULL);
+}
+
+// Records the render pass of one swapchain image, the command buffer is submitted
+// again every frame until the draw generation changes.
+static void record_draw_commands(Renderer *renderer, VkCommandBuffer command_buffer, u32 image_index,
+	VertexRegion vertex_region) {
+	VkCommandBufferBeginInfo command_buffer_begin_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+	};
+	VK_CHECK(vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info));
+
+	VkBuffer vertex_buffer = renderer->upload_mode == UPLOAD_MODE_STAGING ?
+		renderer->vertex_ring.device_buffer.handle : renderer->vertex_ring.buffer.handle;
 
 	VkClearValue clear_values[] = {
 		{.color = {.float32 = { 0.15625f, 0.15625f, 0.15625f, 1.0f } } }
@@ -1451,7 +3127,7 @@ static void renderer_present(Renderer *renderer) {
 	VkRenderPassBeginInfo render_pass_begin_info = {
 		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
 		.renderPass = renderer->render_pass,
-		.framebuffer = renderer->framebuffers[resource_index],
+		.framebuffer = renderer->swapchain.framebuffers[image_index],
 		.renderArea = {
 			.extent = {
 				.width = renderer->swapchain.extent.width,
@@ -1461,16 +3137,24 @@ static void renderer_present(Renderer *renderer) {
 		.clearValueCount = ARRAY_LENGTH(clear_values),
 		.pClearValues = clear_values
 	};
-	vkCmdBeginRenderPass(renderer->command_buffers[resource_index],
-		&render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-
-	vkCmdBindPipeline(renderer->command_buffers[resource_index], VK_PIPELINE_BIND_POINT_GRAPHICS,
-		renderer->graphics_pipeline.handle);
-	vkCmdBindDescriptorSets(renderer->command_buffers[resource_index], VK_PIPELINE_BIND_POINT_GRAPHICS,
+	gpu_query_begin(&renderer->swapchain.queries, command_buffer, image_index);
+	vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+
+	vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, renderer->graphics_pipeline.handle);
+	vkCmdSetViewport(command_buffer, 0, 1, &(VkViewport) {
+		.width = (float)renderer->swapchain.extent.width,
+		.height = (float)renderer->swapchain.extent.height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f
+	});
+	vkCmdSetScissor(command_buffer, 0, 1, &(VkRect2D) {
+		.extent = renderer->swapchain.extent
+	});
+	vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
 		renderer->graphics_pipeline.layout, 0, 1, &renderer->descriptor_set.handle, 0, NULL);
 
 	VkDeviceSize offsets = 0;
-	vkCmdBindVertexBuffers(renderer->command_buffers[resource_index], 0, 1, &renderer->vertex_buffer.handle, &offsets);
+	vkCmdBindVertexBuffers(command_buffer, 0, 1, &vertex_buffer, &offsets);
 
 	GraphicsPushConstants graphics_push_constants = {
 		.display_size = {
@@ -1478,35 +3162,110 @@ static void renderer_present(Renderer *renderer) {
 			(float)renderer->swapchain.extent.height
 		},
 		.glyph_atlas_size = GLYPH_ATLAS_SIZE,
+		.first_line = renderer->first_line,
 		.glyph_width = renderer->glyph_resources.glyph_atlas.metrics.glyph_width,
 		.glyph_height = renderer->glyph_resources.glyph_atlas.metrics.glyph_height,
 		.cell_width = renderer->glyph_resources.glyph_atlas.metrics.cell_width,
 		.cell_height = renderer->glyph_resources.glyph_atlas.metrics.cell_height
 	};
-	vkCmdPushConstants(renderer->command_buffers[resource_index], renderer->graphics_pipeline.layout,
+	vkCmdPushConstants(command_buffer, renderer->graphics_pipeline.layout,
 		VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
 		sizeof(GraphicsPushConstants), &graphics_push_constants);
 
-	vkCmdDraw(renderer->command_buffers[resource_index], renderer->active_vertex_count, 1, 0, 0);
+	// Every glyph instance is expanded into the six vertices of its quad
+	vkCmdDraw(command_buffer, 6, (u32)vertex_region.count, 0, (u32)vertex_region.offset);
 
-	vkCmdEndRenderPass(renderer->command_buffers[resource_index]);
+	vkCmdEndRenderPass(command_buffer);
+	gpu_query_end(&renderer->swapchain.queries, command_buffer, image_index);
 
-	VK_CHECK(vkEndCommandBuffer(renderer->command_buffers[resource_index]));
+	if(renderer->headless) {
+		record_readback(command_buffer, &renderer->swapchain, image_index);
+	}
 
-	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	VkSubmitInfo submit_info = {
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.waitSemaphoreCount = 1,
-		.pWaitSemaphores = &renderer->image_available_semaphores[resource_index],
-		.pWaitDstStageMask = &wait_stage,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &renderer->command_buffers[resource_index],
-		.signalSemaphoreCount = 1,
-		.pSignalSemaphores = &renderer->render_finished_semaphores[resource_index]
-	};
+	VK_CHECK(vkEndCommandBuffer(command_buffer));
+}
+
+static void renderer_present(Renderer *renderer) {
+	TRACE_ZONE_BEGIN(zone, "renderer_present");
+	u32 resource_index = renderer->frame_index;
+
+	QueueTimeline *timeline = &renderer->graphics_timeline;
+	queue_timeline_wait(timeline, renderer->frame_timeline_values[resource_index]);
+
+	// Every frame slot has its own offscreen image, the wait above already covers it
+	u32 image_index = resource_index;
+	bool swapchain_suboptimal = false;
+	if(!renderer->headless) {
+		VkResult result = vkAcquireNextImageKHR(renderer->logical_device.handle, renderer->swapchain.handle, 
+			UINT64_MAX, renderer->image_available_semaphores[resource_index], VK_NULL_HANDLE,
+			&image_index);
+		if(result == VK_ERROR_OUT_OF_DATE_KHR) {
+			// Nothing is submitted for this slot, its timeline value stays the same
+			renderer_resize(renderer);
+			renderer->frame_index = (resource_index + 1) % MAX_FRAMES_IN_FLIGHT;
+			TRACE_ZONE_END(zone);
+			return;
+		}
+		swapchain_suboptimal = result == VK_SUBOPTIMAL_KHR;
+		if(!swapchain_suboptimal) {
+			VK_CHECK(result);
+		}
+	}
+
+	VertexRegion vertex_region = renderer->vertex_ring.regions[resource_index];
+	VkCommandBuffer command_buffers[2];
+	u32 command_buffer_count = 0;
+	if(renderer->upload_mode == UPLOAD_MODE_STAGING && renderer->vertex_upload_pending) {
+		if(vertex_region.count > 0) {
+			record_vertex_upload(renderer, renderer->command_buffers[resource_index], vertex_region);
+			command_buffers[command_buffer_count++] = renderer->command_buffers[resource_index];
+		}
+		renderer->vertex_upload_pending = false;
+	}
+
+	// The command buffer of this image can still be executing from the last time the
+	// image was drawn to, it may neither be submitted again nor re-recorded before it finished
+	Swapchain *swapchain = &renderer->swapchain;
+	queue_timeline_wait(timeline, swapchain->image_timeline_values[image_index]);
+	// The last submission of the image has finished, so reading its queries does not stall
+	gpu_profiler_collect(&renderer->gpu_profiler, &swapchain->queries, image_index);
+	gpu_profiler_collect(&renderer->gpu_profiler, &renderer->gpu_profiler.glyph_queries, 0);
+
+	if(swapchain->recorded_generations[image_index] != renderer->draw_generation) {
+		record_draw_commands(renderer, swapchain->command_buffers[image_index], image_index, vertex_region);
+		swapchain->recorded_generations[image_index] = renderer->draw_generation;
+	}
+	command_buffers[command_buffer_count++] = swapchain->command_buffers[image_index];
 
-	VK_CHECK(vkQueueSubmit(renderer->logical_device.graphics_queue, 1, &submit_info,
-		renderer->fences[resource_index]));
+	// The glyph atlas and font buffers are uploaded without blocking the CPU,
+	// drawing waits on the GPU for the value that marks those uploads as completed
+	SubmitWait waits[] = {
+		{
+			.semaphore = timeline->semaphore,
+			.value = renderer->upload_timeline_value,
+			.stage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+		},
+		{
+			.semaphore = renderer->image_available_semaphores[resource_index],
+			.stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		}
+	};
+	u64 timeline_value = renderer->headless ?
+		queue_timeline_submit(timeline, command_buffers, command_buffer_count, waits, 1, VK_NULL_HANDLE) :
+		queue_timeline_submit(timeline, command_buffers, command_buffer_count, waits, ARRAY_LENGTH(waits),
+			renderer->render_finished_semaphores[resource_index]);
+	renderer->frame_timeline_values[resource_index] = timeline_value;
+	swapchain->image_timeline_values[image_index] = timeline_value;
+	renderer->presented_image_index = image_index;
+	gpu_query_submitted(&swapchain->queries, image_index);
+	gpu_profiler_end_frame(&renderer->gpu_profiler);
+
+	if(renderer->headless) {
+		renderer->frame_index = (resource_index + 1) % MAX_FRAMES_IN_FLIGHT;
+		frame_pacer_end_frame(&renderer->frame_pacer);
+		TRACE_ZONE_END(zone);
+		return;
+	}
 
 	VkPresentInfoKHR present_info = {
 		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -1517,20 +3276,39 @@ static void renderer_present(Renderer *renderer) {
 		.pImageIndices = &image_index,
 	};
 
-	result = vkQueuePresentKHR(renderer->logical_device.graphics_queue, &present_info);
-	if(!((result == VK_SUCCESS) || (result == VK_SUBOPTIMAL_KHR))) {
-		if(result == VK_ERROR_OUT_OF_DATE_KHR) {
-			renderer_resize(renderer);
-			return;
-		}
+	VkResult result = vkQueuePresentKHR(renderer->logical_device.graphics_queue, &present_info);
+	// A suboptimal swapchain still presents, but it is recreated right away so
+	// the contents follow the window while it is being resized
+	if(swapchain_suboptimal || result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR) {
+		renderer_resize(renderer);
 	}
-	VK_CHECK(result);
+	else {
+		VK_CHECK(result);
+	}
+
+	renderer->frame_index = (resource_index + 1) % MAX_FRAMES_IN_FLIGHT;
+	frame_pacer_end_frame(&renderer->frame_pacer);
+	TRACE_ZONE_END(zone);
+}
+
+// Copies the last presented frame into pixels as tightly packed B8G8R8A8 rows of the
+// swapchain extent, blocking until the GPU has finished it. Only available headless.
+static void renderer_read_back_frame(Renderer *renderer, u8 *pixels) {
+	assert(renderer->headless);
+	Swapchain *swapchain = &renderer->swapchain;
+	u32 image_index = renderer->presented_image_index;
+	queue_timeline_wait(&renderer->graphics_timeline, swapchain->image_timeline_values[image_index]);
+	memcpy(pixels, swapchain->readback_buffers[image_index].data,
+		(u64)swapchain->extent.width * swapchain->extent.height * 4);
+}
 
-	resource_index = (resource_index + 1) % MAX_FRAMES_IN_FLIGHT;
+// Call before sampling input for a new frame
+static void renderer_wait_for_next_frame(Renderer *renderer) {
+	frame_pacer_begin_frame(&renderer->frame_pacer);
 }
 
+// Safe to call from any thread
 u32 renderer_get_number_of_lines_on_screen(Renderer *renderer) {
-	return (u32)ceil((float)renderer->swapchain.extent.height / 
-		renderer->glyph_resources.glyph_atlas.metrics.cell_height);
+	return platform_atomic_load_u32(&renderer->lines_on_screen);
 }
 
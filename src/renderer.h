@@ -1,7 +1,27 @@
 #pragma once
 
+#include "gpu_allocator.h"
+#include "gpu_profiler.h"
+
 #define MAX_FRAMES_IN_FLIGHT 3
 
+// How data written by the CPU reaches buffers read by the GPU. On devices with unified
+// memory the GPU reads the mapped buffers directly, otherwise the data is written to
+// host-visible staging buffers and copied into device-local buffers. The copies are recorded
+// on the queue that reads the data, so no queue family ownership transfer is needed.
+typedef enum UploadMode {
+	UPLOAD_MODE_MAPPED_DIRECT,
+	UPLOAD_MODE_STAGING
+} UploadMode;
+
+// How the glyph atlas is rasterized. Lines flattens the outlines on the CPU and tests every
+// sample against every line. Curves keeps the quadratic curves of the outline and solves their
+// crossing with each sample row analytically, which needs far fewer primitives per glyph.
+typedef enum GlyphRasterizer {
+	GLYPH_RASTERIZER_LINES,
+	GLYPH_RASTERIZER_CURVES
+} GlyphRasterizer;
+
 typedef struct PhysicalDevice {
 	VkPhysicalDevice handle;
 	VkPhysicalDeviceProperties2 properties;
@@ -9,6 +29,11 @@ typedef struct PhysicalDevice {
 	VkSurfaceCapabilitiesKHR surface_capabilities;
 	u32 graphics_family_idx;
 	u32 compute_family_idx;
+	bool has_unified_memory;
+	// 0 if the queue family writes no timestamps
+	u32 graphics_timestamp_valid_bits;
+	u32 compute_timestamp_valid_bits;
+	bool has_pipeline_statistics;
 } PhysicalDevice;
 
 typedef struct LogicalDevice {
@@ -17,6 +42,12 @@ typedef struct LogicalDevice {
 	VkQueue compute_queue;
 } LogicalDevice;
 
+typedef struct MappedBuffer {
+	VkBuffer handle;
+	void *data;
+	GpuAllocation allocation;
+} MappedBuffer;
+
 typedef struct Swapchain {
 	VkSwapchainKHR handle;
 	u64 image_count;
@@ -25,6 +56,22 @@ typedef struct Swapchain {
 	VkExtent2D extent;
 	VkImage *images;
 	VkImageView *image_views;
+	VkFramebuffer *framebuffers;
+
+	// Pre-recorded render pass of every image, re-recorded only when
+	// the draw generation differs from the one it was recorded with
+	VkCommandBuffer *command_buffers;
+	u64 *recorded_generations;
+	// Timeline value of the frame that last submitted the command buffer of the image
+	u64 *image_timeline_values;
+	// One slot per image around its render pass. The pools belong to the swapchain so that
+	// the command buffers of a retired swapchain never share queries with the new one.
+	GpuQuerySet queries;
+
+	// Only set for offscreen images, which are owned by the renderer instead of a swapchain
+	// handle. Every frame is copied into the host-visible readback buffer of its image.
+	GpuAllocation *image_allocations;
+	MappedBuffer *readback_buffers;
 } Swapchain;
 
 typedef struct DescriptorSet {
@@ -41,14 +88,89 @@ typedef struct Pipeline {
 typedef struct Image {
 	VkImage handle;
 	VkImageView view;
-	VkDeviceMemory memory;
+	GpuAllocation allocation;
 } Image;
 
-typedef struct MappedBuffer {
+typedef struct Buffer {
 	VkBuffer handle;
-	void *data;
-	VkDeviceMemory memory;
-} MappedBuffer;
+	GpuAllocation allocation;
+} Buffer;
+
+typedef struct VertexRegion {
+	u64 offset;
+	u64 count;
+	u64 consumed;
+} VertexRegion;
+
+// Ring allocator over the persistently mapped vertex buffer. Every frame in flight
+// owns one region, which is only handed back once the timeline value of that frame has been reached.
+// The buffer is sized from the swapchain extent, grows on demand and shrinks again
+// after a sustained period of low usage. In staging mode the mapped buffer is only
+// a staging area and every region is copied to the same offset of device_buffer.
+typedef struct VertexRing {
+	MappedBuffer buffer;
+	Buffer device_buffer;
+	u64 capacity;
+	u64 min_capacity;
+	u64 head;
+	u64 used;
+	VertexRegion regions[MAX_FRAMES_IN_FLIGHT];
+
+	u64 peak_count;
+	u32 frames_since_shrink_check;
+} VertexRing;
+
+// Timeline semaphore of a queue, every submission signals the next value. Work on
+// other queues can wait for a value, and the CPU only waits for the values it needs.
+typedef struct QueueTimeline {
+	VkDevice device;
+	VkQueue queue;
+	VkSemaphore semaphore;
+	u64 submitted_value;
+	u64 completed_value;
+} QueueTimeline;
+
+typedef enum RetiredResourceType {
+	RETIRED_RESOURCE_BUFFER,
+	RETIRED_RESOURCE_COMMAND_BUFFER,
+	RETIRED_RESOURCE_VERTEX_RING,
+	RETIRED_RESOURCE_SWAPCHAIN
+} RetiredResourceType;
+
+// Destroyed once the timeline reaches the value of the last submission that used it
+typedef struct RetiredResource {
+	RetiredResourceType type;
+	u64 timeline_value;
+	union {
+		Buffer buffer;
+		VkCommandBuffer command_buffer;
+		VertexRing vertex_ring;
+		Swapchain swapchain;
+	};
+} RetiredResource;
+
+typedef struct RetiredResources {
+	RetiredResource *resources;
+	u32 count;
+	u32 capacity;
+} RetiredResources;
+
+// Encoded glyph instances of one document line, reused across frames
+// until the line, the font or the column it starts at changes.
+typedef struct GlyphInstanceBlock {
+	GlyphInstance *instances;
+	u32 count;
+	u32 capacity;
+	u32 version;
+	u32 column;
+	bool valid;
+} GlyphInstanceBlock;
+
+// Blocks indexed by document line
+typedef struct GlyphInstanceCache {
+	GlyphInstanceBlock *blocks;
+	u32 num_blocks;
+} GlyphInstanceCache;
 
 typedef struct GlyphPoint {
 	float x;
@@ -60,6 +182,14 @@ typedef struct GlyphLine {
 	GlyphPoint b;
 } GlyphLine;
 
+// Monotonic in y with a the upper end point, the layout of write_texture_atlas_curves.comp
+typedef struct GlyphCurve {
+	GlyphPoint a;
+	GlyphPoint control;
+	GlyphPoint b;
+} GlyphCurve;
+
+// With GLYPH_RASTERIZER_CURVES the offsets and counts are of curves instead of lines
 typedef struct GlyphOffset {
 	u32 offset;
 	u32 num_lines;
@@ -75,13 +205,28 @@ typedef struct GlyphMetrics {
 } GlyphMetrics;
 
 typedef struct TessellatedGlyphs {
+	GlyphRasterizer rasterizer;
+	// Only the array of the rasterizer is allocated, num_lines is its length
 	GlyphLine *lines;
+	GlyphCurve *curves;
 	u64 num_lines;
 	GlyphOffset *glyph_offsets;
 	u64 num_glyphs;
 	GlyphMetrics metrics;
 } TessellatedGlyphs;
 
+// Loads and tessellates the font on a worker thread. FreeType needs no Vulkan objects,
+// so this overlaps with the Vulkan initialization until the glyph buffers are uploaded.
+typedef struct FontLoader {
+	const char *font_path;
+	const char *fallback_font_path; // Used if font_path is missing or in an unsupported format
+	u32 font_size;
+	float flattening_tolerance;
+	GlyphRasterizer rasterizer;
+	Thread thread;
+	TessellatedGlyphs tessellated_glyphs;
+} FontLoader;
+
 typedef struct GlyphPushConstants {
 	float glyph_width;
 	float glyph_height;
@@ -92,8 +237,9 @@ typedef struct GlyphPushConstants {
 typedef struct GlyphAtlas {
 	Image atlas;
 	GlyphMetrics metrics;
-	MappedBuffer lines_buffer;
-	MappedBuffer offsets_buffer;
+	GlyphCellTable cell_table;
+	Buffer lines_buffer; // The curves with GLYPH_RASTERIZER_CURVES
+	Buffer offsets_buffer;
 } GlyphAtlas;
 
 typedef struct GlyphResources {
@@ -115,30 +261,74 @@ typedef struct Window {
 } Window;
 #endif
 
+// Schedules the start of every frame so that input is sampled and the frame is
+// recorded as late as possible while still making the next vertical blank.
+typedef struct FramePacer {
+	u64 refresh_period_ns; // Zero when frames are not paced
+	u64 next_vblank_ns;
+	u64 frame_start_ns;
+	u64 frame_time_estimate_ns;
+} FramePacer;
+
 typedef struct Renderer {
 	Window window;
+	// Renders into offscreen images that are read back, without a window, surface or swapchain
+	bool headless;
 
 	VkInstance instance;
 	VkSurfaceKHR surface;
 
 	LogicalDevice logical_device;
 	PhysicalDevice physical_device;
+	GpuAllocator allocator;
+	GpuProfiler gpu_profiler;
 	Swapchain swapchain;
+	VkPresentModeKHR preferred_present_mode;
+	FramePacer frame_pacer;
 
 	VkCommandPool command_pool;
 	VkCommandBuffer command_buffers[MAX_FRAMES_IN_FLIGHT];
 	VkSemaphore image_available_semaphores[MAX_FRAMES_IN_FLIGHT];
 	VkSemaphore render_finished_semaphores[MAX_FRAMES_IN_FLIGHT];
-	VkFence fences[MAX_FRAMES_IN_FLIGHT];
-	VkFramebuffer framebuffers[MAX_FRAMES_IN_FLIGHT];
+
+	QueueTimeline graphics_timeline;
+	u64 frame_timeline_values[MAX_FRAMES_IN_FLIGHT];
+	// Frames wait for the uploads made during initialization on the GPU only
+	u64 upload_timeline_value;
+	RetiredResources retired_resources;
+
+	// Glyph atlas rasterization runs on the compute queue, which may be a separate queue family
+	VkCommandPool compute_command_pool;
+	QueueTimeline compute_timeline;
+	RetiredResources compute_retired_resources;
 
 	DescriptorSet descriptor_set;
 	VkSampler texture_sampler;
 	VkRenderPass render_pass;
+	// Loaded from and written back to pipeline_cache_path, empty when there is no cache directory
+	VkPipelineCache pipeline_cache;
+	char pipeline_cache_path[FILENAME_MAX];
 	Pipeline graphics_pipeline;
-	MappedBuffer vertex_buffer;
+	UploadMode upload_mode;
+	VertexRing vertex_ring;
+
+	u32 frame_index;
+	u32 presented_image_index;
+
+	GlyphInstanceCache text_instance_cache;
+	GlyphInstanceCache number_instance_cache;
+	u32 first_line;
+
+	// Written by the render thread whenever the swapchain changes, read by the editor thread
+	volatile u32 lines_on_screen;
 
-	u32 active_vertex_count;
+	// Incremented whenever the vertex data or push constants change
+	u64 draw_generation;
+	u32 *drawn_block_keys;
+	u32 num_drawn_block_keys;
+	u32 drawn_block_keys_capacity;
+	u32 vertex_region_slot;
+	bool vertex_upload_pending;
 
 	GlyphResources glyph_resources;
 
@@ -147,12 +337,18 @@ typedef struct Renderer {
 #endif
 } Renderer;
 
-static Renderer renderer_initialize(Window window);
+// device_override selects a device by index or by a part of its name, NULL picks the best scoring one
+static Renderer renderer_initialize(Window window, VkPresentModeKHR preferred_present_mode,
+	const char *device_override, GlyphRasterizer glyph_rasterizer);
+static Renderer renderer_initialize_headless(u32 width, u32 height, const char *device_override,
+	GlyphRasterizer glyph_rasterizer);
 
 static void renderer_destroy(Renderer *renderer);
 static void renderer_resize(Renderer *renderer);
 static void renderer_update_draw_lists(Renderer *renderer, DrawList *draw_lists, u32 num_draw_lists);
 static void renderer_present(Renderer *renderer);
+static void renderer_wait_for_next_frame(Renderer *renderer);
+static void renderer_read_back_frame(Renderer *renderer, u8 *pixels);
 
 static u32 renderer_get_number_of_lines_on_screen(Renderer *renderer);
 
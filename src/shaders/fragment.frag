@@ -7,6 +7,7 @@ layout(push_constant) uniform PushConstants {
     uint cell_width;
     uint cell_height;
     uint glyph_atlas_size;
+    uint first_line;
 } pc;
 
 layout(binding = 0) uniform usampler2D glyph_atlas;
@@ -25,18 +25,21 @@ layout(push_constant) uniform PushConstants {
 	uint cell_width;
 	uint cell_height;
 	uint glyph_atlas_size;
+	uint first_line;
 } pc;
 
-layout(location = 0) in uvec2 in_vertex;
+// One instance per glyph, x holds the atlas cell and y the column and document line
+layout(location = 0) in uvec2 in_instance;
 layout(location = 0) out vec2 out_uv;
 layout(location = 1) flat out uvec2 out_glyph_offset;
 
 void main() {
-	vec2 pos = positions[bitfieldExtract(in_vertex.x, 0, 3)] * vec2(pc.glyph_width / 3.0f, pc.glyph_height);
-	vec2 offset = vec2(bitfieldExtract(in_vertex.y, 0, 16), bitfieldExtract(in_vertex.y, 16, 16)) * vec2(pc.glyph_width / 3.0f, pc.glyph_height);
+	vec2 pos = positions[gl_VertexIndex] * vec2(pc.glyph_width / 3.0f, pc.glyph_height);
+	uint row = (bitfieldExtract(in_instance.y, 16, 16) - pc.first_line) & 0xFFFF;
+	vec2 offset = vec2(bitfieldExtract(in_instance.y, 0, 16), row) * vec2(pc.glyph_width / 3.0f, pc.glyph_height);
 	gl_Position = vec4((pos + offset) * vec2(2.0 / pc.display_size.x, 2.0 / pc.display_size.y) - vec2(1.0), 0.0, 1.0);  
 
-	out_uv = uv_coords[bitfieldExtract(in_vertex.x, 3, 3)]; 
-	out_glyph_offset = uvec2(bitfieldExtract(in_vertex.x, 6, 13), bitfieldExtract(in_vertex.x, 19, 13)); 
+	out_uv = uv_coords[gl_VertexIndex]; 
+	out_glyph_offset = uvec2(bitfieldExtract(in_instance.x, 0, 16), bitfieldExtract(in_instance.x, 16, 16)); 
 }
 
@@ -6,15 +6,20 @@ typedef enum DrawCommandType {
 	DRAW_COMMAND_RECT
 } DrawCommandType;
 
+// line identifies the document line the command draws, version changes
+// whenever the content of that line changes.
 typedef struct DrawCommandText {
 	const char *content;
 	u32 length;
+	u32 line;
+	u32 version;
 	u32 row;
 	u32 column;
 } DrawCommandText;
 
 typedef struct DrawCommandNumber {
 	u32 num;
+	u32 line;
 	u32 row;
 	u32 column;
 } DrawCommandNumber;
@@ -0,0 +1,106 @@
+#include "trace.h"
+
+static u64 trace_start_ns;
+static TraceThreadBuffer trace_thread_buffers[TRACE_MAX_THREADS];
+static volatile u32 trace_thread_count;
+// Shared by all threads beyond TRACE_MAX_THREADS, it has no events and drops their zones
+static TraceThreadBuffer trace_overflow_buffer;
+static TRACE_THREAD_LOCAL TraceThreadBuffer *trace_thread_buffer;
+
+static void trace_enable(void) {
+	trace_start_ns = platform_get_time_ns();
+	trace_enabled = true;
+}
+
+static TraceThreadBuffer *get_trace_thread_buffer(void) {
+	if(trace_thread_buffer) {
+		return trace_thread_buffer;
+	}
+
+	u32 index = platform_atomic_add_u32(&trace_thread_count, 1);
+	if(index >= TRACE_MAX_THREADS) {
+		trace_thread_buffer = &trace_overflow_buffer;
+		return trace_thread_buffer;
+	}
+
+	TraceThreadBuffer *buffer = &trace_thread_buffers[index];
+	buffer->events = (TraceEvent *)malloc(TRACE_RING_CAPACITY * sizeof(TraceEvent));
+	buffer->thread_index = index;
+	trace_thread_buffer = buffer;
+	return buffer;
+}
+
+static void trace_zone_end(TraceZone *zone) {
+	TraceThreadBuffer *buffer = get_trace_thread_buffer();
+	if(!buffer->events) {
+		return;
+	}
+
+	u32 head = buffer->head;
+	buffer->events[head & (TRACE_RING_CAPACITY - 1)] = (TraceEvent) {
+		.name = zone->name,
+		.start_ns = zone->start_ns,
+		.end_ns = platform_get_time_ns()
+	};
+	platform_atomic_store_u32(&buffer->head, head + 1);
+}
+
+static void trace_set_thread_name(const char *name) {
+	if(trace_enabled) {
+		get_trace_thread_buffer()->thread_name = name;
+	}
+}
+
+static bool trace_write_chrome_json(const char *path) {
+	FILE *file = fopen(path, "w");
+	if(!file) {
+		printf("Could not open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	bool first_event = true;
+	u32 thread_count = MIN(platform_atomic_load_u32(&trace_thread_count), TRACE_MAX_THREADS);
+	for(u32 i = 0; i < thread_count; ++i) {
+		TraceThreadBuffer *buffer = &trace_thread_buffers[i];
+		if(!buffer->events) {
+			continue;
+		}
+
+		if(buffer->thread_name) {
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first_event ? "" : ",\n", buffer->thread_index, buffer->thread_name);
+			first_event = false;
+		}
+
+		// Only the newest TRACE_RING_CAPACITY zones survive, oldest first
+		u32 head = platform_atomic_load_u32(&buffer->head);
+		u32 count = MIN(head, TRACE_RING_CAPACITY);
+		for(u32 j = head - count; j != head; ++j) {
+			TraceEvent event = buffer->events[j & (TRACE_RING_CAPACITY - 1)];
+			// Complete events in microseconds relative to trace_enable
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				first_event ? "" : ",\n", event.name, buffer->thread_index,
+				(double)(event.start_ns - trace_start_ns) / 1e3, (double)(event.end_ns - event.start_ns) / 1e3);
+			first_event = false;
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool written = !ferror(file);
+	written = fclose(file) == 0 && written;
+	if(written) {
+		printf("Wrote trace to %s\n", path);
+	}
+	return written;
+}
+
+static void trace_destroy(void) {
+	u32 thread_count = MIN(platform_atomic_load_u32(&trace_thread_count), TRACE_MAX_THREADS);
+	for(u32 i = 0; i < thread_count; ++i) {
+		free(trace_thread_buffers[i].events);
+		trace_thread_buffers[i] = (TraceThreadBuffer) { 0 };
+	}
+	platform_atomic_store_u32(&trace_thread_count, 0);
+	trace_enabled = false;
+}
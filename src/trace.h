@@ -0,0 +1,58 @@
+#pragma once
+
+// Scoped zones written to a ring buffer per thread and exported as Chrome trace event JSON,
+// which chrome://tracing and ui.perfetto.dev open directly. Recording is off unless trace_enable
+// was called, a disabled zone costs one well-predicted branch at its beginning and one at its end.
+#define TRACE_MAX_THREADS 16
+#define TRACE_RING_CAPACITY 65536 // Zones per thread, must be a power of two
+
+#ifdef _MSC_VER
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#define TRACE_UNLIKELY(x) (x)
+#else
+#define TRACE_THREAD_LOCAL _Thread_local
+#define TRACE_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#endif
+
+typedef struct TraceEvent {
+	const char *name;
+	u64 start_ns;
+	u64 end_ns;
+} TraceEvent;
+
+// Only the owning thread writes events and head, so recording needs no lock. Once the
+// ring is full the oldest zones are overwritten.
+typedef struct TraceThreadBuffer {
+	TraceEvent *events; // NULL if the thread did not get a buffer, its zones are dropped
+	volatile u32 head;
+	u32 thread_index;
+	const char *thread_name;
+} TraceThreadBuffer;
+
+typedef struct TraceZone {
+	const char *name; // NULL if the zone is not recorded
+	u64 start_ns;
+} TraceZone;
+
+// Only written by trace_enable, before any other thread is started
+static bool trace_enabled;
+
+// Zone names must be string literals, they are stored by pointer and written to the JSON unescaped
+#define TRACE_ZONE_BEGIN(zone, zone_name) 					\
+	TraceZone zone = { 0 }; 								\
+	if(TRACE_UNLIKELY(trace_enabled)) { 					\
+		zone = (TraceZone) { zone_name, platform_get_time_ns() }; \
+	}
+#define TRACE_ZONE_END(zone) 								\
+	if(TRACE_UNLIKELY(zone.name != NULL)) { 				\
+		trace_zone_end(&zone); 								\
+	}
+
+static void trace_enable(void);
+static void trace_zone_end(TraceZone *zone);
+// Names the calling thread in the exported trace
+static void trace_set_thread_name(const char *name);
+
+// Must only be called once all recording threads have stopped, e.g. after they were joined
+static bool trace_write_chrome_json(const char *path);
+static void trace_destroy(void);